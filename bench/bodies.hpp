@@ -0,0 +1,38 @@
+#pragma once
+
+// made-up responses of the clash controller shared by the benchmarks
+
+#include <string>
+
+#include "third-party/nlohmann/json.hpp"
+
+namespace bench {
+
+// a /proxies response of a subscription with n proxies in one selector
+inline std::string proxies_body(size_t n, size_t history) {
+  nlohmann::json proxies = nlohmann::json::object();
+  nlohmann::json all = nlohmann::json::array();
+  for (size_t i = 0; i < n; ++i) {
+    const auto name = "node " + std::to_string(i);
+    nlohmann::json h = nlohmann::json::array();
+    for (size_t k = 0; k < history; ++k) {
+      h.push_back({{"time", "2023-01-01T00:00:00.000000000+08:00"},
+                   {"delay", 50 + (i + k) % 400}});
+    }
+    proxies[name] = {{"name", name},
+                     {"type", "Shadowsocks"},
+                     {"udp", true},
+                     {"history", h}};
+    all.push_back(name);
+  }
+  proxies["DIRECT"] = {{"name", "DIRECT"}, {"type", "Direct"}};
+  proxies["Proxies"] = {
+      {"name", "Proxies"}, {"type", "Selector"}, {"now", "node 0"}, {"all", all}};
+  proxies["Final"] = {{"name", "Final"},
+                      {"type", "Selector"},
+                      {"now", "Proxies"},
+                      {"all", {"DIRECT", "Proxies"}}};
+  return nlohmann::json{{"proxies", proxies}}.dump();
+}
+
+}  // namespace bench
@@ -0,0 +1,268 @@
+// measures the costs of clashctl on its hot paths and prints them as json,
+// so runs before and after a change can be compared
+//   json_parse_*        parsing /proxies responses of growing size
+//   menu_show           drawing a frame of menus of growing size
+//   start_stop          starting clash until it is ready and stopping it
+//   controller_*        round trips to the controller
+// clash is stood in for by tools/mock_clash, run through the controller from
+// a temporary home, so nothing of a real installation is touched
+//
+// usage: clashctl_bench [options]
+//   --iterations <n>  most samples per benchmark, default 200
+//   --budget <ms>     time after which a benchmark stops sampling once it
+//                     has 3 samples, default 2000
+//   --cycles <n>      start and stop cycles, default 5
+//   --filter <str>    only run benchmarks whose name contains str
+//   --mock <path>     the mock clash, default the one built alongside
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "bodies.hpp"
+#include "connections.hpp"
+#include "controller.hpp"
+#include "menu.hpp"
+#include "proxy_model.hpp"
+#include "third-party/nlohmann/json.hpp"
+
+#ifndef CLASHCTL_MOCK_CLASH
+#define CLASHCTL_MOCK_CLASH ""
+#endif
+
+namespace {
+
+struct Options {
+  int iterations = 200;
+  std::chrono::milliseconds budget{2000};
+  int cycles = 5;
+  std::string filter;
+  std::string mock = CLASHCTL_MOCK_CLASH;
+};
+
+class Suite {
+ public:
+  explicit Suite(const Options& opts) noexcept : opts_(opts) {}
+
+  bool wanted(const std::string& name) const {
+    return name.find(opts_.filter) != std::string::npos;
+  }
+
+  // time fn, which returns false when it failed, up to iterations times
+  template <class Fn>
+  void run(const std::string& name, nlohmann::json params, int iterations,
+           Fn&& fn);
+
+  nlohmann::json& results() noexcept { return results_; }
+
+ private:
+  const Options& opts_;
+  nlohmann::json results_ = nlohmann::json::array();
+};
+
+template <class Fn>
+void Suite::run(const std::string& name, nlohmann::json params, int iterations,
+                Fn&& fn) {
+  using clock = std::chrono::steady_clock;
+  if (!wanted(name)) return;
+  std::fprintf(stderr, "%s %s\n", name.c_str(), params.dump().c_str());
+  // warm up caches and lazily built state
+  fn();
+  std::vector<double> samples;
+  samples.reserve(iterations);
+  int failures = 0;
+  const auto begin = clock::now();
+  for (int i = 0; i < iterations; ++i) {
+    const auto start = clock::now();
+    const bool ok = fn();
+    const std::chrono::duration<double, std::micro> elapsed =
+        clock::now() - start;
+    samples.push_back(elapsed.count());
+    failures += !ok;
+    if (samples.size() >= 3 && clock::now() - begin > opts_.budget) break;
+  }
+  std::sort(samples.begin(), samples.end());
+  auto percentile = [&](double p) {
+    return samples[std::min(samples.size() - 1,
+                            static_cast<size_t>(p * samples.size()))];
+  };
+  double sum = 0;
+  for (auto s : samples) sum += s;
+  results_.push_back({{"name", name},
+                      {"params", std::move(params)},
+                      {"iterations", samples.size()},
+                      {"failures", failures},
+                      {"mean_us", sum / samples.size()},
+                      {"min_us", samples.front()},
+                      {"p50_us", percentile(0.5)},
+                      {"p90_us", percentile(0.9)},
+                      {"p99_us", percentile(0.99)},
+                      {"max_us", samples.back()}});
+}
+
+void json_parse(Suite& suite, const Options& opts) {
+  for (size_t n : {10, 100, 1000, 10000}) {
+    const auto body = bench::proxies_body(n, 10);
+    const nlohmann::json params = {{"proxies", n}, {"bytes", body.size()}};
+    suite.run("json_parse_dom", params, opts.iterations, [&]() {
+      return !nlohmann::json::parse(body).empty();
+    });
+    suite.run("json_parse_model", params, opts.iterations, [&]() {
+      return clashctl::ProxyModel::parse(body).size() > 0;
+    });
+  }
+}
+
+void menu_show(Suite& suite, const Options& opts) {
+  for (size_t n : {10, 1000, 100000}) {
+    std::vector<std::string> names;
+    names.reserve(n);
+    for (size_t i = 0; i < n; ++i) names.push_back("node " + std::to_string(i));
+    Menu menu(std::move(names));
+    // decorated like the proxy menu
+    menu.on_opt_show([](int i, const std::string& opt) {
+      return opt + "  " + std::to_string(50 + i % 400) + "ms";
+    });
+    // move the cursor every frame, the renderer skips unchanged frames
+    suite.run("menu_show", {{"options", n}}, opts.iterations, [&]() {
+      if (!menu.down()) {
+        while (menu.left()) {
+        }
+        while (menu.up()) {
+        }
+      }
+      menu.show();
+      return true;
+    });
+  }
+}
+
+// start and stop the mock, then leave it running for the round trips
+bool start_stop(Suite& suite, const Options& opts,
+                const clashctl::Controller& controller) {
+  suite.run("start_stop", nlohmann::json::object(), opts.cycles, [&]() {
+    const bool ok = controller.start();
+    controller.stop();
+    return ok;
+  });
+  return controller.start();
+}
+
+void round_trips(Suite& suite, const Options& opts,
+                 const clashctl::Controller& controller) {
+  const auto none = nlohmann::json::object();
+  suite.run("controller_get_proxies", none, opts.iterations, [&]() {
+    return controller.fetch_proxies().has_value();
+  });
+  if (!controller.refresh()) return;
+  auto proxies = controller.get_proxies();
+  if (!proxies.has_value() || proxies->size() < 2) return;
+  size_t i = 0;
+  suite.run("controller_set_proxy", {{"proxies", proxies->size()}},
+            opts.iterations, [&]() {
+              return controller.set_proxy((*proxies)[i++ % 2]);
+            });
+  // a table kept across iterations, like conns, so after the first only the
+  // counters of connections are read
+  clashctl::ConnectionTable table;
+  suite.run("controller_get_connections", none, opts.iterations, [&]() {
+    return controller.get_connections(table, std::chrono::seconds(1));
+  });
+  suite.run("controller_ping", none, opts.iterations,
+            [&]() { return controller.ping(); });
+}
+
+bool parse_args(int argc, char** argv, Options& opts) {
+  for (int i = 1; i + 1 < argc; i += 2) {
+    const std::string arg = argv[i];
+    const std::string value = argv[i + 1];
+    if (arg == "--iterations") {
+      opts.iterations = std::max(1, std::atoi(value.c_str()));
+    } else if (arg == "--budget") {
+      opts.budget = std::chrono::milliseconds(std::atoi(value.c_str()));
+    } else if (arg == "--cycles") {
+      opts.cycles = std::max(1, std::atoi(value.c_str()));
+    } else if (arg == "--filter") {
+      opts.filter = value;
+    } else if (arg == "--mock") {
+      opts.mock = value;
+    } else {
+      return false;
+    }
+  }
+  return argc % 2 == 1;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Options opts;
+  if (!parse_args(argc, argv, opts)) {
+    std::fprintf(stderr,
+                 "usage: %s [--iterations n] [--budget ms] [--cycles n] "
+                 "[--filter str] [--mock path]\n",
+                 argv[0]);
+    return 2;
+  }
+
+  // everything clashctl prints, and the frames of the menus, go to
+  // /dev/null, the results go to the real stdout
+  std::fflush(stdout);
+  const int out = dup(STDOUT_FILENO);
+  const int devnull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+  if (out < 0 || devnull < 0 || dup2(devnull, STDOUT_FILENO) < 0) {
+    std::perror("failed to redirect stdout");
+    return 1;
+  }
+  close(devnull);
+
+  Suite suite(opts);
+  json_parse(suite, opts);
+  menu_show(suite, opts);
+
+  if ((suite.wanted("start_stop") || suite.wanted("controller_")) &&
+      access(opts.mock.c_str(), X_OK) != 0) {
+    std::fprintf(stderr, "no mock clash at \"%s\", skipping the controller\n",
+                 opts.mock.c_str());
+  } else if (suite.wanted("start_stop") || suite.wanted("controller_")) {
+    namespace fs = std::filesystem;
+    char home[] = "/tmp/clashctl_bench.XXXXXX";
+    if (!mkdtemp(home)) {
+      std::perror("failed to create a temporary home");
+      return 1;
+    }
+    std::error_code ec;
+    fs::create_directories(fs::path(home) / "clashctl" / "config", ec);
+    fs::create_symlink(fs::absolute(opts.mock, ec),
+                       fs::path(home) / "clashctl" / "clashctl-buildin-server",
+                       ec);
+    // ports away from a real clash, the mock listens where these point
+    setenv("HOME", home, 1);
+    setenv("CLASHCTL_CONTROLLER", "127.0.0.1:29090", 1);
+    setenv("CLASHCTL_PROXY", "127.0.0.1:27890", 1);
+    setenv("CLASHCTL_PING_ENDPOINT", "example.com:80", 1);
+
+    clashctl::Config config;
+    clashctl::Controller controller(config);
+    if (start_stop(suite, opts, controller)) {
+      round_trips(suite, opts, controller);
+    } else {
+      std::fprintf(stderr, "failed to start the mock clash\n");
+    }
+    controller.stop();
+    fs::remove_all(home, ec);
+  }
+
+  const auto json = nlohmann::json{{"benchmarks", suite.results()}}.dump(2);
+  FILE* f = fdopen(out, "w");
+  std::fprintf(f, "%s\n", json.c_str());
+  std::fclose(f);
+}
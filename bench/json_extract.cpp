@@ -0,0 +1,132 @@
+// compares reading a /proxies response into a ProxyModel through the sax
+// extraction layer, from a string and streamed in chunks, against parsing
+// the whole document with nlohmann json first
+//
+// usage: json_extract_bench [proxies] [history] [iterations]
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include "bodies.hpp"
+#include "json_extract.hpp"
+#include "proxy_model.hpp"
+
+/*
+ * heap accounting
+ */
+
+namespace {
+
+std::atomic<size_t> live_bytes{0};
+std::atomic<size_t> peak_bytes{0};
+std::atomic<size_t> allocations{0};
+
+// every block is prefixed with its size, so delete knows what to give back
+constexpr size_t header = alignof(std::max_align_t);
+
+void* allocate(size_t size) {
+  auto* p = static_cast<char*>(std::malloc(size + header));
+  if (!p) throw std::bad_alloc();
+  *reinterpret_cast<size_t*>(p) = size;
+  const size_t live = live_bytes += size;
+  size_t peak = peak_bytes;
+  while (live > peak && !peak_bytes.compare_exchange_weak(peak, live)) {
+  }
+  ++allocations;
+  return p + header;
+}
+
+void deallocate(void* ptr) noexcept {
+  if (!ptr) return;
+  auto* p = static_cast<char*>(ptr) - header;
+  live_bytes -= *reinterpret_cast<size_t*>(p);
+  std::free(p);
+}
+
+}  // namespace
+
+void* operator new(size_t size) { return allocate(size); }
+
+void* operator new[](size_t size) { return allocate(size); }
+
+void operator delete(void* p) noexcept { deallocate(p); }
+
+void operator delete[](void* p) noexcept { deallocate(p); }
+
+void operator delete(void* p, size_t) noexcept { deallocate(p); }
+
+void operator delete[](void* p, size_t) noexcept { deallocate(p); }
+
+/*
+ * benchmark
+ */
+
+namespace {
+
+// what the controller did before, parse everything and pick fields out
+size_t dom(const std::string& body) {
+  auto j = nlohmann::json::parse(body);
+  const auto& p = j["proxies"]["Proxies"];
+  return p["all"].size() + p["now"].get<std::string>().size();
+}
+
+size_t sax(const std::string& body) {
+  auto model = clashctl::ProxyModel::parse(body);
+  return model.size();
+}
+
+// fed in 16KiB chunks from another thread, like a response being received
+size_t streamed(const std::string& body) {
+  quicky::ChunkStreamBuf buf;
+  std::thread producer([&]() {
+    constexpr size_t chunk = 16 * 1024;
+    for (size_t at = 0; at < body.size(); at += chunk) {
+      if (!buf.push(body.data() + at, std::min(chunk, body.size() - at))) break;
+    }
+    buf.close();
+  });
+  std::istream in(&buf);
+  auto model = clashctl::ProxyModel::parse(in);
+  buf.done();
+  producer.join();
+  return model.size();
+}
+
+template <class Fn>
+void run(const char* name, const std::string& body, int iterations, Fn&& fn) {
+  using clock = std::chrono::steady_clock;
+  size_t sink = 0;
+  const size_t live_before = live_bytes;
+  peak_bytes = live_before;
+  allocations = 0;
+  const auto begin = clock::now();
+  for (int i = 0; i < iterations; ++i) sink += fn(body);
+  const std::chrono::duration<double, std::milli> elapsed =
+      clock::now() - begin;
+  std::printf("%-10s %10.2f ms/op %12.1f KiB peak %12zu allocs/op  (%zu)\n",
+              name, elapsed.count() / iterations,
+              (peak_bytes - live_before) / 1024.0,
+              allocations / static_cast<size_t>(iterations), sink);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  const size_t proxies = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 2000;
+  const size_t history = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 10;
+  const int iterations = argc > 3 ? std::atoi(argv[3]) : 20;
+  const auto body = bench::proxies_body(proxies, history);
+  std::printf("%zu proxies, %zu delay tests each, %.1f KiB body\n", proxies,
+              history, body.size() / 1024.0);
+  // peak memory excludes the body itself, which the streamed parse never
+  // holds in full
+  run("dom", body, iterations, dom);
+  run("sax", body, iterations, sax);
+  run("streamed", body, iterations, streamed);
+}
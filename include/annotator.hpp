@@ -0,0 +1,132 @@
+#pragma once
+
+/*
+ * Headers
+ */
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "clash_config.hpp"
+#include "controller.hpp"
+#include "dns.hpp"
+#include "mmdb.hpp"
+#include "utils.hpp"
+
+/*
+ * Declaration
+ */
+
+namespace clashctl {
+
+// looks up the country of each proxy's server in the background
+// servers are read from the clash config file, resolved concurrently through
+// a dns cache and looked up in the geoip database
+class GeoAnnotator {
+ public:
+  // on_update is called from a background thread whenever some countries are
+  // found, until the annotator is destroyed
+  GeoAnnotator(const Config& config, const std::vector<std::string>& proxies,
+               std::function<void()>&& on_update);
+
+  GeoAnnotator(const GeoAnnotator&) = delete;
+
+  GeoAnnotator& operator=(const GeoAnnotator&) = delete;
+
+  // stop notifying, lookups still running finish on their own
+  ~GeoAnnotator();
+
+  // the country iso code of a proxy's server, empty if not known (yet)
+  std::string country(const std::string& proxy) const;
+
+ private:
+  // shared with the background thread, which may outlive the annotator while
+  // it waits for a slow dns lookup
+  struct State {
+    std::mutex mutex;
+    bool stopped = false;
+    std::unordered_map<std::string, std::string> countries;
+    std::function<void()> on_update;
+  };
+
+  static void run(std::shared_ptr<State> state, std::string config_file,
+                  std::string mmdb_file, std::string dns_cache_file,
+                  std::vector<std::string> proxies);
+
+ private:
+  std::shared_ptr<State> state_;
+};
+
+}  // namespace clashctl
+
+/*
+ * Implementation that will be part of the .cpp file if split into .hpp and .cpp
+ * files.
+ */
+
+namespace clashctl {
+
+inline GeoAnnotator::GeoAnnotator(const Config& config,
+                                  const std::vector<std::string>& proxies,
+                                  std::function<void()>&& on_update)
+    : state_(std::make_shared<State>()) {
+  state_->on_update = std::move(on_update);
+  std::thread(run, state_, config.clash_config_file, config.clash_mmdb,
+              config.dns_cache, proxies)
+      .detach();
+}
+
+inline GeoAnnotator::~GeoAnnotator() {
+  std::lock_guard<std::mutex> lock(state_->mutex);
+  state_->stopped = true;
+}
+
+inline std::string GeoAnnotator::country(const std::string& proxy) const {
+  std::lock_guard<std::mutex> lock(state_->mutex);
+  auto it = state_->countries.find(proxy);
+  return it == state_->countries.end() ? "" : it->second;
+}
+
+inline void GeoAnnotator::run(std::shared_ptr<State> state,
+                              std::string config_file, std::string mmdb_file,
+                              std::string dns_cache_file,
+                              std::vector<std::string> proxies) {
+  quicky::Mmdb db;
+  if (!db.open(mmdb_file)) return;
+  const auto servers = read_proxy_servers(config_file);
+
+  // proxies often share servers, resolve each one once
+  std::unordered_map<std::string, std::vector<std::string>> by_host;
+  for (auto&& proxy : proxies) {
+    auto it = servers.find(proxy);
+    if (it != servers.end()) by_host[it->second].push_back(proxy);
+  }
+  std::vector<const decltype(by_host)::value_type*> hosts;
+  for (auto&& h : by_host) hosts.push_back(&h);
+
+  quicky::DnsCache dns(dns_cache_file, std::chrono::hours(1));
+  quicky::parallel_for(hosts.size(), 16, [&](size_t i) {
+    {
+      std::lock_guard<std::mutex> lock(state->mutex);
+      if (state->stopped) return;
+    }
+    auto ip = dns.resolve(hosts[i]->first);
+    if (!ip.has_value()) return;
+    auto country = db.country(*ip);
+    if (!country.has_value()) return;
+
+    std::lock_guard<std::mutex> lock(state->mutex);
+    for (auto&& proxy : hosts[i]->second) {
+      state->countries[proxy] = std::string(*country);
+    }
+    if (!state->stopped) state->on_update();
+  });
+  dns.save();
+}
+
+}  // namespace clashctl
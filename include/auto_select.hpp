@@ -0,0 +1,166 @@
+#pragma once
+
+/*
+ * Headers
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "controller.hpp"
+#include "utils.hpp"
+
+/*
+ * Declaration
+ */
+
+namespace clashctl {
+
+// keeps clash on a fast proxy by testing the delay of every member of the
+// proxy group every config.auto_interval
+// the current proxy is kept while it is healthy, and only left for one that
+// beat it by config.auto_margin in each of the last config.auto_rounds
+// rounds, so a single lucky test or two proxies of about the same delay do
+// not make it flap
+// a current proxy failing its test twice in a row is left right away for the
+// fastest of the round
+class AutoSelect {
+ public:
+  // select switches the proxy, returning whether it worked
+  AutoSelect(const Config& config, const Controller& controller,
+             std::function<bool(const std::string&)>&& select) noexcept
+      : config_(config), controller_(controller), select_(std::move(select)) {}
+
+  // test and switch every config.auto_interval until stop is called or the
+  // process is signalled
+  void run() noexcept;
+
+  // safe to call from any thread
+  void stop() noexcept { sleeper_.stop(); }
+
+  // take a round of delays of names, nullopt for a failed test, and return
+  // the proxy to switch to from current, if any
+  std::optional<std::string> decide(
+      const std::string& current, const std::vector<std::string>& names,
+      const std::vector<std::optional<int>>& delays) noexcept;
+
+ private:
+  const Config& config_;
+  const Controller& controller_;
+  std::function<bool(const std::string&)> select_;
+  // the proxy the state below is about
+  std::string current_;
+  // consecutive failed tests of the current proxy
+  int failures_ = 0;
+  // consecutive rounds each proxy beat the current one by the margin
+  std::unordered_map<std::string, int> streaks_;
+  quicky::Sleeper sleeper_;
+};
+
+}  // namespace clashctl
+
+/*
+ * Implementation that will be part of the .cpp file if split into .hpp and .cpp
+ * files.
+ */
+
+namespace clashctl {
+
+inline void AutoSelect::run() noexcept {
+  const auto interval = std::chrono::milliseconds(config_.auto_interval);
+  do {
+    // the proxy may have been switched by hand since the last round
+    if (!controller_.refresh()) {
+      quicky::errorln("clash is not available.");
+      continue;
+    }
+    const auto names = controller_.get_proxies();
+    const auto current = controller_.get_proxy();
+    if (!names.has_value() || names->empty()) {
+      quicky::errorln("failed to get available proxies.");
+      continue;
+    }
+    std::vector<std::optional<int>> delays(names->size());
+    quicky::parallel_for(names->size(), 16, [&](size_t i) {
+      delays[i] = controller_.get_delay((*names)[i]);
+    });
+    if (sleeper_.stopping()) break;
+
+    const auto next = decide(current, *names, delays);
+    if (!next.has_value()) continue;
+    auto delay_of = [&](const std::string& name) -> nlohmann::json {
+      const auto it = std::find(names->begin(), names->end(), name);
+      if (it == names->end() || !delays[it - names->begin()]) return nullptr;
+      return *delays[it - names->begin()];
+    };
+    const auto from_ms = delay_of(current), to_ms = delay_of(*next);
+    if (!select_(*next)) {
+      quicky::error() << "failed to switch to " << *next << "." << std::endl;
+      continue;
+    }
+    quicky::info() << "switched from " << current << " ("
+                   << (from_ms.is_null() ? "timeout" : from_ms.dump() + "ms")
+                   << ") to " << *next << " (" << to_ms.dump() << "ms)."
+                   << std::endl;
+    controller_.events().info(
+        "auto.switch",
+        {{"from", current}, {"to", *next}, {"from_ms", from_ms},
+         {"to_ms", to_ms}});
+  } while (sleeper_.sleep(interval));
+}
+
+inline std::optional<std::string> AutoSelect::decide(
+    const std::string& current, const std::vector<std::string>& names,
+    const std::vector<std::optional<int>>& delays) noexcept {
+  if (current != current_) {
+    current_ = current;
+    failures_ = 0;
+    streaks_.clear();
+  }
+
+  // the fastest of the round, and the delay of the current proxy
+  std::optional<size_t> fastest;
+  std::optional<int> current_delay;
+  for (size_t i = 0; i < names.size(); ++i) {
+    if (!delays[i].has_value()) continue;
+    if (names[i] == current) {
+      current_delay = delays[i];
+      continue;
+    }
+    // they answer delay tests but never go through a proxy
+    if (names[i] == "DIRECT" || names[i] == "REJECT") continue;
+    if (!fastest || *delays[i] < *delays[*fastest]) fastest = i;
+  }
+  if (!fastest.has_value()) return std::nullopt;
+
+  const bool known =
+      std::find(names.begin(), names.end(), current) != names.end();
+  failures_ = current_delay.has_value() ? 0 : failures_ + 1;
+  if (!known || failures_ >= 2) return names[*fastest];
+  if (!current_delay.has_value()) return std::nullopt;
+
+  // a proxy missing a round starts over, like one not beating the margin
+  std::unordered_map<std::string, int> streaks;
+  std::optional<size_t> best;
+  for (size_t i = 0; i < names.size(); ++i) {
+    if (names[i] == current || !delays[i].has_value()) continue;
+    if (names[i] == "DIRECT" || names[i] == "REJECT") continue;
+    if (*delays[i] + config_.auto_margin > *current_delay) continue;
+    const int streak = streaks_[names[i]] + 1;
+    streaks[names[i]] = streak;
+    if (streak >= config_.auto_rounds &&
+        (!best || *delays[i] < *delays[*best])) {
+      best = i;
+    }
+  }
+  streaks_ = std::move(streaks);
+  if (!best.has_value()) return std::nullopt;
+  return names[*best];
+}
+
+}  // namespace clashctl
@@ -0,0 +1,166 @@
+#pragma once
+
+/*
+ * Headers
+ */
+
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * Declaration
+ */
+
+namespace clashctl {
+
+// read the server of every proxy listed in a clash config file, by name
+// this is not a yaml parser, it only understands the two ways subscriptions
+// list proxies:
+//   - {name: a, server: a.example.com, port: 443, ...}
+// and
+//   - name: a
+//     server: a.example.com
+std::unordered_map<std::string, std::string> read_proxy_servers(
+    const std::string& config_file) noexcept;
+
+}  // namespace clashctl
+
+/*
+ * Implementation that will be part of the .cpp file if split into .hpp and .cpp
+ * files.
+ */
+
+namespace clashctl {
+
+namespace detail {
+
+inline std::string_view trim(std::string_view s) noexcept {
+  while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) {
+    s.remove_prefix(1);
+  }
+  while (!s.empty() &&
+         (s.back() == ' ' || s.back() == '\t' || s.back() == '\r')) {
+    s.remove_suffix(1);
+  }
+  return s;
+}
+
+// a scalar without its quotes or trailing comment
+inline std::string scalar(std::string_view s) noexcept {
+  s = trim(s);
+  if (s.size() >= 2 && (s.front() == '"' || s.front() == '\'')) {
+    const auto end = s.find(s.front(), 1);
+    if (end != std::string_view::npos) return std::string(s.substr(1, end - 1));
+  }
+  const auto comment = s.find(" #");
+  if (comment != std::string_view::npos) s = trim(s.substr(0, comment));
+  return std::string(s);
+}
+
+// split "key: value" on the first colon followed by a space or the end
+inline bool key_value(std::string_view s, std::string_view& key,
+                      std::string_view& value) noexcept {
+  for (size_t i = 0; i < s.size(); ++i) {
+    if (s[i] == '"' || s[i] == '\'') {
+      const auto end = s.find(s[i], i + 1);
+      if (end == std::string_view::npos) return false;
+      i = end;
+    } else if (s[i] == ':' && (i + 1 == s.size() || s[i + 1] == ' ')) {
+      key = trim(s.substr(0, i));
+      value = trim(s.substr(i + 1));
+      return true;
+    }
+  }
+  return false;
+}
+
+// the top level "key: value" pairs of a flow map like "{a: 1, b: {c: 2}}"
+inline void flow_map(std::string_view s, std::string& name,
+                     std::string& server) noexcept {
+  s = trim(s);
+  if (s.empty() || s.front() != '{') return;
+  s.remove_prefix(1);
+  int depth = 0;
+  size_t begin = 0;
+  for (size_t i = 0; i <= s.size(); ++i) {
+    const char c = i < s.size() ? s[i] : ',';
+    if (c == '"' || c == '\'') {
+      const auto end = s.find(c, i + 1);
+      if (end == std::string_view::npos) return;
+      i = end;
+    } else if (c == '{' || c == '[') {
+      ++depth;
+    } else if ((c == '}' || c == ']') && depth > 0) {
+      --depth;
+    } else if ((c == ',' || c == '}') && depth == 0) {
+      std::string_view key, value;
+      if (key_value(s.substr(begin, i - begin), key, value)) {
+        if (scalar(key) == "name") name = scalar(value);
+        if (scalar(key) == "server") server = scalar(value);
+      }
+      begin = i + 1;
+      if (c == '}') return;
+    }
+  }
+}
+
+}  // namespace detail
+
+inline std::unordered_map<std::string, std::string> read_proxy_servers(
+    const std::string& config_file) noexcept {
+  std::unordered_map<std::string, std::string> servers;
+  std::ifstream f(config_file);
+  std::string line;
+  bool in_proxies = false;
+  size_t item_indent = std::string::npos;
+  size_t key_indent = 0;
+  std::string name, server;
+  auto flush = [&]() {
+    if (!name.empty() && !server.empty()) servers[name] = server;
+    name.clear();
+    server.clear();
+  };
+
+  while (std::getline(f, line)) {
+    const std::string_view l = detail::trim(line);
+    if (l.empty() || l.front() == '#') continue;
+    const bool top_level = line.front() != ' ' && line.front() != '\t';
+
+    if (top_level && l.front() != '-') {
+      if (in_proxies) break;
+      in_proxies = l.substr(0, 8) == "proxies:";
+      continue;
+    }
+    if (!in_proxies) continue;
+
+    // keys and lists nested deeper than the proxy's own keys are ignored
+    size_t indent = line.find_first_not_of(" \t");
+    std::string_view item = l;
+    if (item.front() == '-' && (item_indent == std::string::npos ||
+                                indent == item_indent)) {
+      flush();
+      item_indent = indent;
+      item = detail::trim(item.substr(1));
+      const auto first_key = line.find_first_not_of(" \t", indent + 1);
+      key_indent = first_key == std::string::npos ? indent + 2 : first_key;
+      indent = key_indent;
+      if (!item.empty() && item.front() == '{') {
+        detail::flow_map(item, name, server);
+        flush();
+        continue;
+      }
+    }
+    if (indent != key_indent) continue;
+    std::string_view key, value;
+    if (!detail::key_value(item, key, value)) continue;
+    if (key == "name") name = detail::scalar(value);
+    if (key == "server") server = detail::scalar(value);
+  }
+  flush();
+  return servers;
+}
+
+}  // namespace clashctl
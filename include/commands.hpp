@@ -4,15 +4,38 @@
  * Headers
  */
 
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
 #include <functional>
+#include <iomanip>
 #include <iostream>
 #include <map>
+#include <memory>
+#include <optional>
+#include <regex>
 #include <string>
+#include <thread>
 #include <vector>
 
+#include "annotator.hpp"
+#include "auto_select.hpp"
+#include "connections.hpp"
 #include "controller.hpp"
+#include "daemon.hpp"
+#include "logs.hpp"
 #include "menu.hpp"
+#include "mmdb.hpp"
+#include "traffic.hpp"
 #include "utils.hpp"
+#include "watchdog.hpp"
 
 /*
  * Declaration
@@ -52,8 +75,45 @@ class Commands {
 
   void proxy() noexcept;
 
+  // set the proxy or the mode without a menu
+  void set(const std::string& what, const std::string& name) noexcept;
+
+  // through the daemon when one runs, so what it serves stays current
+  bool select(const std::string& what, const std::string& name) noexcept;
+
+  // take the snapshot of a daemon reaching clash, through the proxy cache it
+  // rewrites on every refresh
+  // returns false if no daemon reaches clash
+  bool load_daemon_proxies() noexcept;
+
+  void status() noexcept;
+
+  void daemon(bool stop) noexcept;
+
+  void watch(bool stats) noexcept;
+
+  // keep switching to a faster proxy, until interrupted
+  void auto_select() noexcept;
+
+  void bench(size_t workers) noexcept;
+
   void update(const std::string& url);
 
+  void rollback(size_t n) noexcept;
+
+  void generations() noexcept;
+
+  void geoip() noexcept;
+
+  void traffic() noexcept;
+
+  void logs(const std::string& level, const std::string& pattern,
+            size_t buffer) noexcept;
+
+  void conns(size_t n) noexcept;
+
+  void close_conns(const std::string& pattern) noexcept;
+
  private:
   clashctl::Config config;
   clashctl::Controller controller_;
@@ -107,11 +167,125 @@ inline std::map<std::string, Commands::Opt> Commands::init_opts() noexcept {
   opts["help"] = {"help", "show usage", std::bind(&Commands::help, this)};
   opts["start"] = {"start", "start clash", std::bind(&Commands::start, this)};
   opts["stop"] = {"stop", "stop clash", std::bind(&Commands::stop, this)};
-  opts["reload"] = {"reload", "reload clash",
+  opts["reload"] = {"reload", "reload clash config in place",
                     std::bind(&Commands::reload, this)};
-  opts["ping"] = {"ping", "curl google.com", std::bind(&Commands::ping, this)};
-  opts["mode"] = {"mode", "select mode", std::bind(&Commands::mode, this)};
-  opts["proxy"] = {"proxy", "select proxy", std::bind(&Commands::proxy, this)};
+  opts["ping"] = {"ping", "visit google.com through clash",
+                  std::bind(&Commands::ping, this)};
+  opts["mode"] = {"mode [mode]", "select mode, or set it", [this]() {
+                   if (args_.get().size() >= 2) {
+                     set("mode", args_.get()[1]);
+                   } else {
+                     mode();
+                   }
+                 }};
+  opts["proxy"] = {"proxy [proxy]", "select proxy, or set it", [this]() {
+                    if (args_.get().size() >= 2) {
+                      set("proxy", args_.get()[1]);
+                    } else {
+                      proxy();
+                    }
+                  }};
+  opts["status"] = {"status", "print the proxy and its delay on one line",
+                    std::bind(&Commands::status, this)};
+  opts["daemon"] = {"daemon [stop]",
+                    "keep state warm for fast one-shot calls, or stop it",
+                    [this]() {
+                      daemon(args_.get().size() >= 2 &&
+                             args_.get()[1] == "stop");
+                    }};
+  opts["watch"] = {"watch [stats]",
+                   "restart clash whenever it dies, or show its outages",
+                   [this]() {
+                     watch(args_.get().size() >= 2 &&
+                           args_.get()[1] == "stats");
+                   }};
+  opts["auto"] = {"auto",
+                  "keep switching to the fastest proxy, without flapping",
+                  std::bind(&Commands::auto_select, this)};
+  opts["bench"] = {"bench [workers]",
+                   "test the delay of all proxies concurrently", [this]() {
+                     size_t workers = 16;
+                     if (args_.get().size() >= 2) {
+                       try {
+                         workers = std::stoul(args_.get()[1]);
+                       } catch (const std::exception&) {
+                         quicky::errorln("[workers] should be a number.");
+                         return;
+                       }
+                     }
+                     bench(workers);
+                   }};
+  opts["rollback"] = {"rollback [n]",
+                      "switch back to the n-th previous config, default 1",
+                      [this]() {
+                        size_t n = 1;
+                        if (args_.get().size() >= 2) {
+                          try {
+                            n = std::stoul(args_.get()[1]);
+                          } catch (const std::exception&) {
+                            quicky::errorln("[n] should be a number.");
+                            return;
+                          }
+                        }
+                        rollback(n);
+                      }};
+  opts["generations"] = {"generations", "list the configs kept for rollback",
+                         std::bind(&Commands::generations, this)};
+  opts["geoip"] = {"geoip [ip]...",
+                   "look up countries of ips, or of ips read from stdin",
+                   std::bind(&Commands::geoip, this)};
+  opts["traffic"] = {"traffic", "show live upload and download rates",
+                     std::bind(&Commands::traffic, this)};
+  opts["conns"] = {"conns [n] | close [regex]",
+                   "watch the n busiest connections, or close connections",
+                   [this]() {
+                     const auto& args = args_.get();
+                     if (args.size() >= 2 && args[1] == "close") {
+                       close_conns(args.size() >= 3 ? args[2] : "");
+                       return;
+                     }
+                     size_t n = 20;
+                     if (args.size() >= 2) {
+                       try {
+                         n = std::stoul(args[1]);
+                       } catch (const std::exception&) {
+                         quicky::errorln("[n] should be a number.");
+                         return;
+                       }
+                     }
+                     conns(n);
+                   }};
+  opts["logs"] = {"logs [--level <level>] [--grep <regex>] [--buffer <n>]",
+                  "follow the clash log", [this]() {
+                    std::string level = "info", pattern;
+                    size_t buffer = 1024;
+                    const auto& args = args_.get();
+                    for (size_t i = 1; i < args.size(); ++i) {
+                      if (i + 1 >= args.size()) {
+                        quicky::error() << "missing value for " << args[i]
+                                        << std::endl;
+                        return;
+                      }
+                      const auto& value = args[++i];
+                      if (args[i - 1] == "--level") {
+                        level = value;
+                      } else if (args[i - 1] == "--grep") {
+                        pattern = value;
+                      } else if (args[i - 1] == "--buffer") {
+                        try {
+                          buffer = std::stoul(value);
+                        } catch (const std::exception&) {
+                          quicky::errorln("--buffer should be a number.");
+                          return;
+                        }
+                      } else {
+                        quicky::error() << "unknown option " << args[i - 1]
+                                        << std::endl;
+                        return;
+                      }
+                    }
+                    logs(level, pattern, buffer);
+                  }};
   opts["update"] = {"update <url>",
                     "download config from <url> and reload clash", [this]() {
                       if (args_.get().size() < 2) {
@@ -148,7 +322,7 @@ inline void Commands::help() noexcept {
 
 inline void Commands::start() noexcept {
   quicky::infoln("starting clash.");
-  if (!controller_.reload()) {
+  if (!controller_.restart()) {
     quicky::errorln("failed to start clash.");
   } else {
     quicky::infoln("clash is now available.");
@@ -163,36 +337,51 @@ inline void Commands::stop() noexcept {
 inline void Commands::reload() noexcept {
   if (!controller_.reload()) {
     quicky::errorln("failed to reload clash.");
+    return;
   }
   quicky::infoln("reloaded clash.");
 }
 
 inline void Commands::ping() noexcept {
-  if (!controller_.ping()) {
+  auto stats = controller_.probe();
+  if (!stats.has_value()) {
     quicky::infoln("clash is not available.");
-  } else {
-    quicky::infoln("clash is available.");
+    return;
   }
+  quicky::info() << std::fixed << std::setprecision(1)
+                 << "clash is available. connect: " << stats->connect.count()
+                 << "ms, handshake: " << stats->handshake.count()
+                 << "ms, first byte: " << stats->first_byte.count() << "ms."
+                 << std::endl;
 }
 
 inline void Commands::mode() noexcept {
+  // otherwise fetched from clash
+  load_daemon_proxies();
   auto mode = controller_.get_mode();
   if (mode.empty()) {
     quicky::errorln("failed to get current mode.");
     return;
   }
-  auto modes = clashctl::Mode::modes();
-  Menu menu(std::move(modes));
+  auto modes = controller_.get_modes();
+  if (!modes.has_value()) {
+    quicky::errorln("failed to get available modes.");
+    return;
+  }
+  Menu menu(std::move(modes.value()));
 
   menu.on_opt_show([&](int, const std::string& opt) {
     return mode == opt ? opt + " 😎" : opt;
   });
 
   menu.on_opt_enter([&](int, const std::string& opt) {
-    if (!controller_.set_mode(opt)) {
+    if (select("mode", opt)) {
+      mode = opt;
+    } else {
       quicky::error() << "failed to set mode to " << opt << std::endl;
+      controller_.refresh();
+      mode = controller_.get_mode();
     }
-    mode = controller_.get_mode();
     if (mode.empty()) {
       quicky::errorln("failed to get current mode.");
       return false;
@@ -205,6 +394,11 @@ inline void Commands::mode() noexcept {
 }
 
 inline void Commands::proxy() noexcept {
+  // a daemon keeps the snapshot fresh, without one draw the last known
+  // state right away and revalidate it in the background, falling back to
+  // asking clash first
+  const bool served = load_daemon_proxies();
+  const bool cached = !served && controller_.load_cached_proxies();
   auto proxy = controller_.get_proxy();
   if (proxy.empty()) {
     quicky::errorln("failed to get current proxy.");
@@ -215,17 +409,56 @@ inline void Commands::proxy() noexcept {
     quicky::errorln("failed to get available proxies.");
     return;
   }
-  Menu menu(std::move(proxies.value()));
+  Menu menu(std::vector<std::string>(proxies.value()));
+  // countries are filled in as their lookups finish
+  auto annotate = [&]() {
+    return std::make_unique<GeoAnnotator>(config, proxies.value(),
+                                          [&]() { menu.post([]() {}); });
+  };
+  auto annotator = annotate();
+
+  std::thread revalidate;
+  if (cached) {
+    revalidate = std::thread([&]() {
+      auto fresh = controller_.fetch_proxies();
+      if (!fresh.has_value()) {
+        menu.post([&]() {
+          menu.notice("failed to get proxies from clash, showing the cached.");
+        });
+        return;
+      }
+      // patch the menu from its own thread
+      menu.post([&, fresh = std::move(*fresh)]() mutable {
+        controller_.use_proxies(std::move(fresh));
+        auto now = controller_.get_proxies();
+        if (!now.has_value()) return;
+        proxy = controller_.get_proxy();
+        if (*now == *proxies) return;
+        proxies = std::move(now);
+        annotator = annotate();
+        menu.set_opts(std::vector<std::string>(proxies.value()));
+      });
+    });
+  }
 
+  const auto& model = controller_.proxy_model();
   menu.on_opt_show([&](int, const std::string& opt) {
-    return proxy == opt ? opt + " 😎" : opt;
+    auto country = annotator->country(opt);
+    auto line = country.empty() ? opt : opt + " [" + country + "]";
+    // the delay clash measured last, if any
+    auto delay = model ? model->last_delay(opt) : std::nullopt;
+    if (delay.has_value()) line += " " + std::to_string(*delay) + "ms";
+    return proxy == opt ? line + " 😎" : line;
   });
 
   menu.on_opt_enter([&](int, const std::string& opt) {
-    if (!controller_.set_proxy(opt)) {
+    if (select("proxy", opt)) {
+      proxy = opt;
+    } else {
       quicky::error() << "failed to set proxy to " << opt << std::endl;
+      controller_.refresh();
+      proxy = controller_.get_proxy();
     }
-    proxy = controller_.get_proxy();
     if (proxy.empty()) {
       quicky::errorln("failed to get current proxy.");
       return false;
@@ -235,6 +468,110 @@ inline void Commands::proxy() noexcept {
   });
 
   menu.main();
+  if (revalidate.joinable()) revalidate.join();
+}
+
+inline void Commands::set(const std::string& what,
+                          const std::string& name) noexcept {
+  if (!select(what, name)) {
+    quicky::error() << "failed to set " << what << " to " << name << std::endl;
+    return;
+  }
+  quicky::info() << "current " << what << ": " << name << std::endl;
+}
+
+inline bool Commands::select(const std::string& what,
+                             const std::string& name) noexcept {
+  auto reply = Daemon::call(config.daemon_socket, {what, name});
+  // a daemon reaching clash already tried, clash would refuse again
+  if (reply.has_value() && reply->out != Daemon::offline) return reply->ok;
+  const bool ok = what == "proxy" ? controller_.set_proxy(name)
+                                  : controller_.set_mode(name);
+  // what the daemon holds is stale now
+  if (ok && reply.has_value()) Daemon::call(config.daemon_socket, {"refresh"});
+  return ok;
+}
+
+inline bool Commands::load_daemon_proxies() noexcept {
+  auto reply = Daemon::call(config.daemon_socket, {"status"});
+  return reply.has_value() && reply->ok && controller_.load_cached_proxies();
+}
+
+inline void Commands::status() noexcept {
+  auto reply = Daemon::call(config.daemon_socket, {"status"});
+  auto line = reply.has_value() ? reply->out : controller_.status();
+  std::cout << (line.empty() ? "offline" : line) << std::endl;
+}
+
+inline void Commands::daemon(bool stop) noexcept {
+  if (!stop) {
+    Daemon(config, controller_).serve();
+    return;
+  }
+  auto reply = Daemon::call(config.daemon_socket, {"stop"});
+  if (!reply.has_value()) {
+    quicky::errorln("no daemon is running.");
+    return;
+  }
+  quicky::infoln(reply->out.c_str());
+}
+
+inline void Commands::watch(bool stats) noexcept {
+  if (stats) {
+    std::cout << Watchdog::summary(config.watchdog_stats) << std::endl;
+    return;
+  }
+  signal(SIGINT, quicky::Sleeper::on_signal);
+  signal(SIGTERM, quicky::Sleeper::on_signal);
+  Watchdog watchdog(config, controller_);
+  quicky::infoln("watching clash.");
+  watchdog.run();
+}
+
+inline void Commands::auto_select() noexcept {
+  signal(SIGINT, quicky::Sleeper::on_signal);
+  signal(SIGTERM, quicky::Sleeper::on_signal);
+  AutoSelect selector(config, controller_, [this](const std::string& name) {
+    return select("proxy", name);
+  });
+  quicky::info() << "testing proxies every " << config.auto_interval / 1000
+                 << "s, switching for " << config.auto_margin << "ms faster in "
+                 << config.auto_rounds << " rounds in a row." << std::endl;
+  selector.run();
+}
+
+inline void Commands::bench(size_t workers) noexcept {
+  auto proxies = controller_.get_proxies();
+  if (!proxies.has_value()) {
+    quicky::errorln("failed to get available proxies.");
+    return;
+  }
+  const auto proxy = controller_.get_proxy();
+  auto& names = proxies.value();
+  std::vector<std::optional<int>> delays(names.size());
+
+  quicky::info() << "testing " << names.size() << " proxies with " << workers
+                 << " workers." << std::endl;
+  quicky::parallel_for(names.size(), workers, [&](size_t i) {
+    delays[i] = controller_.get_delay(names[i]);
+  });
+
+  std::vector<size_t> order(names.size());
+  for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+  // proxies that failed the test go last
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    if (delays[a].has_value() != delays[b].has_value()) {
+      return delays[a].has_value();
+    }
+    return delays[a].value_or(0) < delays[b].value_or(0);
+  });
+
+  for (auto i : order) {
+    std::cout << std::setw(10) << std::left
+              << (delays[i] ? std::to_string(*delays[i]) + "ms" : "timeout");
+    std::cout << (proxy == names[i] ? names[i] + " 😎" : names[i])
+              << std::endl;
+  }
 }
 
 inline void Commands::update(const std::string& url) {
@@ -247,4 +584,298 @@ inline void Commands::update(const std::string& url) {
   quicky::infoln("updated config.");
 }
 
+inline void Commands::rollback(size_t n) noexcept {
+  if (!controller_.rollback(n)) {
+    quicky::errorln("failed to roll back config.");
+    return;
+  }
+  quicky::info() << "switched to config "
+                 << controller_.generations().current().substr(0, 12) << "."
+                 << std::endl;
+}
+
+inline void Commands::generations() noexcept {
+  const auto& generations = controller_.generations();
+  const auto history = generations.history();
+  const auto current = generations.current();
+  for (size_t i = 0; i < history.size(); ++i) {
+    std::error_code ec;
+    const auto mtime = std::filesystem::last_write_time(
+        generations.path(history[i]), ec);
+    // file_clock has no portable conversion before c++20
+    const auto stored = std::chrono::system_clock::to_time_t(
+        std::chrono::system_clock::now() +
+        std::chrono::duration_cast<std::chrono::system_clock::duration>(
+            mtime - std::filesystem::file_time_type::clock::now()));
+    char date[32] = "";
+    if (!ec) {
+      std::strftime(date, sizeof(date), "%F %T", std::localtime(&stored));
+    }
+    std::cout << std::setw(4) << std::left << i << history[i].substr(0, 12)
+              << "  " << date
+              << (history[i] == current ? "  (current)" : "") << std::endl;
+  }
+}
+
+inline void Commands::geoip() noexcept {
+  quicky::Mmdb db;
+  if (!db.open(config.clash_mmdb)) {
+    quicky::error() << "failed to open " << config.clash_mmdb << std::endl;
+    return;
+  }
+  std::string out;
+  auto lookup = [&](std::string_view ip) {
+    auto country = db.country(ip);
+    out.append(ip);
+    out += '\t';
+    if (country.has_value()) {
+      out.append(*country);
+    } else {
+      out += '-';
+    }
+    out += '\n';
+    if (out.size() >= (1 << 16)) {
+      std::fwrite(out.data(), 1, out.size(), stdout);
+      out.clear();
+    }
+  };
+
+  const auto& args = args_.get();
+  if (args.size() >= 2 && args[1] != "-") {
+    for (size_t i = 1; i < args.size(); ++i) lookup(args[i]);
+  } else {
+    // bulk mode, one ip per line
+    std::vector<char> buf(1 << 16);
+    size_t kept = 0;
+    size_t n;
+    while ((n = std::fread(buf.data() + kept, 1, buf.size() - kept,
+                           stdin)) > 0) {
+      const std::string_view chunk(buf.data(), kept + n);
+      size_t begin = 0;
+      for (size_t end; (end = chunk.find('\n', begin)) != chunk.npos;
+           begin = end + 1) {
+        auto line = chunk.substr(begin, end - begin);
+        if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+        if (!line.empty()) lookup(line);
+      }
+      kept = chunk.size() - begin;
+      std::memmove(buf.data(), buf.data() + begin, kept);
+      // a line longer than the buffer can not be an ip
+      if (kept == buf.size()) kept = 0;
+    }
+    if (kept > 0) lookup(std::string_view(buf.data(), kept));
+  }
+  std::fwrite(out.data(), 1, out.size(), stdout);
+  std::fflush(stdout);
+}
+
+inline void Commands::traffic() noexcept {
+  clashctl::TrafficMeter meter;
+  // redraw a single line on a terminal, print one line per second otherwise
+  const bool tty = isatty(STDOUT_FILENO);
+  std::string out;
+  const bool stopped =
+      controller_.stream("/traffic", [&](std::string_view line) {
+        auto up = quicky::json_uint(line, "up");
+        auto down = quicky::json_uint(line, "down");
+        if (!up.has_value() || !down.has_value()) return true;
+        meter.push({*up, *down});
+        out.clear();
+        if (tty) out += "\r";
+        out += meter.format();
+        out += tty ? "\x1b[K" : "\n";
+        std::fwrite(out.data(), 1, out.size(), stdout);
+        std::fflush(stdout);
+        return true;
+      });
+  if (tty && meter.count() > 0) std::cout << std::endl;
+  if (!stopped) quicky::errorln("traffic stream from clash ended.");
+}
+
+inline void Commands::logs(const std::string& level, const std::string& pattern,
+                           size_t buffer) noexcept {
+  const auto& levels = LogBuffer::levels();
+  if (std::find(levels.begin(), levels.end(), level) == levels.end()) {
+    quicky::error() << "level should be one of debug, info, warning, error."
+                    << std::endl;
+    return;
+  }
+  std::optional<std::regex> regex;
+  try {
+    if (!pattern.empty()) regex.emplace(pattern);
+  } catch (const std::regex_error& e) {
+    quicky::error() << "invalid regex: " << e.what() << std::endl;
+    return;
+  }
+
+  // clash filters by level, the regex is matched by the printer so that a
+  // burst never holds up the stream
+  LogBuffer entries(std::max<size_t>(buffer, 1));
+  std::thread printer([&]() {
+    std::string out;
+    size_t dropped = 0;
+    auto print = [&](const LogEntry& entry) {
+      if (regex && !std::regex_search(entry.payload, *regex)) return;
+      char time[16];
+      std::strftime(time, sizeof(time), "%T", std::localtime(&entry.time));
+      out += time;
+      out += ' ';
+      out += entry.type;
+      out.append(entry.type.size() < 8 ? 8 - entry.type.size() : 1, ' ');
+      out += entry.payload;
+      out += '\n';
+    };
+    while (entries.drain(print, dropped)) {
+      if (dropped > 0) {
+        out.insert(0, "... " + std::to_string(dropped) +
+                          " entries dropped while printing fell behind\n");
+      }
+      std::fwrite(out.data(), 1, out.size(), stdout);
+      std::fflush(stdout);
+      out.clear();
+    }
+  });
+
+  const bool stopped = controller_.stream(
+      "/logs?level=" + level,
+      [&](std::string_view line) {
+        entries.push(line);
+        return true;
+      },
+      // the log may stay quiet for a long time
+      std::chrono::hours(24));
+  entries.close();
+  printer.join();
+  if (!stopped) quicky::errorln("log stream from clash ended.");
+}
+
+inline void Commands::conns(size_t n) noexcept {
+  using clock = std::chrono::steady_clock;
+  constexpr auto interval = std::chrono::seconds(1);
+  ConnectionTable table;
+  Renderer renderer;
+  // the row selected for closing
+  size_t selected = 0;
+  std::vector<std::string> lines;
+  std::string rates;
+
+  auto refresh = [&](clock::duration elapsed) {
+    return controller_.get_connections(table, elapsed);
+  };
+  auto show = [&]() {
+    const auto& top = table.top(n);
+    if (!top.empty()) selected = std::min(selected, top.size() - 1);
+    lines.clear();
+    rates.clear();
+    rates += std::to_string(table.size()) + " connections  up ";
+    TrafficMeter::format_rate(rates, table.up_rate());
+    rates += "  down ";
+    TrafficMeter::format_rate(rates, table.down_rate());
+    lines.push_back(rates);
+    lines.emplace_back();
+    for (size_t i = 0; i < top.size(); ++i) {
+      rates.clear();
+      TrafficMeter::format_rate(rates, top[i]->up_rate);
+      rates.resize(std::max<size_t>(rates.size() + 1, 12), ' ');
+      TrafficMeter::format_rate(rates, top[i]->down_rate);
+      rates.resize(std::max<size_t>(rates.size() + 1, 24), ' ');
+      rates += top[i]->host + "  " + top[i]->chain;
+      if (i == selected) rates += " 👈";
+      lines.push_back(rates);
+    }
+    lines.emplace_back();
+    lines.push_back(
+        "use `w`, `s` to select, `x` to close the selected, `X` to close all "
+        "listed, `q` to quit.");
+    renderer.render(lines);
+  };
+  auto close = [&](bool all) {
+    const auto& top = table.top(n);
+    std::vector<std::string> ids;
+    for (size_t i = 0; i < top.size(); ++i) {
+      if (all || i == selected) ids.push_back(top[i]->id);
+    }
+    controller_.close_connections(ids);
+  };
+
+  auto last = clock::now();
+  if (!refresh(interval)) {
+    quicky::errorln("failed to get connections.");
+    return;
+  }
+  if (!isatty(STDIN_FILENO) || !isatty(STDOUT_FILENO)) {
+    // a single listing, rates need a second snapshot
+    std::this_thread::sleep_for(interval);
+    if (!refresh(clock::now() - last)) return;
+    for (auto&& conn : table.top(n)) {
+      rates.clear();
+      TrafficMeter::format_rate(rates, conn->up_rate);
+      rates += '\t';
+      TrafficMeter::format_rate(rates, conn->down_rate);
+      std::cout << rates << '\t' << conn->host << '\t' << conn->chain << '\n';
+    }
+    std::cout.flush();
+    return;
+  }
+
+  RawMode::enable();
+  show();
+  char buf[64];
+  while (true) {
+    const auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+        last + interval - clock::now());
+    pollfd pfd{STDIN_FILENO, POLLIN, 0};
+    const int ready = poll(&pfd, 1, std::max<int>(wait.count(), 0));
+    if (ready < 0 && errno != EINTR) break;
+    if (ready > 0) {
+      const ssize_t size = read(STDIN_FILENO, buf, sizeof(buf));
+      if (size <= 0) break;
+      bool quit = false;
+      for (ssize_t i = 0; i < size; ++i) {
+        if (buf[i] == 'q') quit = true;
+        if (buf[i] == 'w' && selected > 0) --selected;
+        if (buf[i] == 's') ++selected;
+        if (buf[i] == 'x' || buf[i] == 'X') close(buf[i] == 'X');
+      }
+      if (quit) break;
+    }
+    const auto now = clock::now();
+    if (now - last >= interval) {
+      if (!refresh(now - last)) {
+        renderer.finish();
+        quicky::errorln("failed to get connections.");
+        return;
+      }
+      last = now;
+    }
+    show();
+  }
+  renderer.finish();
+}
+
+inline void Commands::close_conns(const std::string& pattern) noexcept {
+  std::optional<std::regex> regex;
+  try {
+    if (!pattern.empty()) regex.emplace(pattern);
+  } catch (const std::regex_error& e) {
+    quicky::error() << "invalid regex: " << e.what() << std::endl;
+    return;
+  }
+  ConnectionTable table;
+  if (!controller_.get_connections(table, std::chrono::seconds(1))) {
+    quicky::errorln("failed to get connections.");
+    return;
+  }
+  std::vector<std::string> ids;
+  for (auto&& conn : table.top(table.size())) {
+    if (!regex || std::regex_search(conn->host, *regex) ||
+        std::regex_search(conn->chain, *regex)) {
+      ids.push_back(conn->id);
+    }
+  }
+  const auto closed = controller_.close_connections(ids);
+  quicky::info() << "closed " << closed << " of " << ids.size()
+                 << " connections." << std::endl;
+}
+
 };  // namespace clashctl
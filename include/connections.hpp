@@ -0,0 +1,271 @@
+#pragma once
+
+/*
+ * Headers
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "json_extract.hpp"
+#include "third-party/nlohmann/json.hpp"
+
+/*
+ * Declaration
+ */
+
+namespace clashctl {
+
+// a connection through clash, as listed by /connections
+struct Connection {
+  std::string id;
+  // host:port, or the destination ip if clash did not see a host name
+  std::string host;
+  // the groups and the proxy it goes through, like "Proxies > node"
+  std::string chain;
+  // bytes transferred since it was opened
+  uint64_t upload = 0;
+  uint64_t download = 0;
+  // bytes per second since the previous snapshot
+  double up_rate = 0;
+  double down_rate = 0;
+  // the snapshot it was last seen in
+  uint64_t seen = 0;
+};
+
+// the open connections, kept up to date from successive /connections
+// snapshots
+// a snapshot is parsed as it streams in and never built as a whole, only the
+// byte counters of every connection are materialized, plus the metadata and
+// chains of new ones
+// clash sends the id of a connection before its metadata and chains, so those
+// of known connections are skipped, a server sending them first only costs
+// building them
+// the ranking is kept between snapshots and re-sorted only as far as it is
+// shown
+class ConnectionTable {
+ public:
+  // merge the /connections body taken `elapsed` after the previous one, a
+  // string or a stream
+  // throws std::invalid_argument if it is not valid json, leaving the table
+  // partly updated
+  template <class Input>
+  void update(Input&& body, std::chrono::duration<double> elapsed);
+
+  // the n connections with the highest current throughput, fastest first
+  const std::vector<const Connection*>& top(size_t n);
+
+  size_t size() const noexcept { return conns_.size(); }
+
+  // the throughput of all connections, in bytes per second
+  double up_rate() const noexcept { return up_rate_; }
+
+  double down_rate() const noexcept { return down_rate_; }
+
+  // the bytes transferred by clash since it started, as last reported
+  double upload_total() const noexcept { return upload_total_; }
+
+  double download_total() const noexcept { return download_total_; }
+
+ private:
+  // the fields of a connection in the snapshot being parsed
+  struct Entry {
+    std::string id;
+    uint64_t upload = 0;
+    uint64_t download = 0;
+    // empty if skipped, as they are for known connections
+    nlohmann::json metadata;
+    nlohmann::json chains;
+  };
+
+  // merge a connection of the snapshot being parsed
+  void merge(Entry& entry, double seconds);
+
+  static std::string describe_host(const nlohmann::json& metadata);
+
+  static std::string describe_chain(const nlohmann::json& chains);
+
+ private:
+  std::unordered_map<std::string, Connection> conns_;
+  // every connection, roughly in the order of the last ranking
+  std::vector<const Connection*> order_;
+  // whether connections came or went since order_ was built
+  bool changed_ = false;
+  std::vector<const Connection*> top_;
+  uint64_t generation_ = 0;
+  double up_rate_ = 0;
+  double down_rate_ = 0;
+  double upload_total_ = 0;
+  double download_total_ = 0;
+};
+
+}  // namespace clashctl
+
+/*
+ * Implementation of template methods.
+ */
+
+namespace clashctl {
+
+template <class Input>
+void ConnectionTable::update(Input&& body,
+                             std::chrono::duration<double> elapsed) {
+  ++generation_;
+  const double seconds = std::max(elapsed.count(), 1e-3);
+  up_rate_ = down_rate_ = 0;
+  Entry entry;
+  quicky::JsonExtractor extractor(
+      {{"uploadTotal"},
+       {"downloadTotal"},
+       // only matched to learn where each connection starts
+       {"connections", "*"},
+       {"connections", "*", "id"},
+       {"connections", "*", "upload"},
+       {"connections", "*", "download"},
+       {"connections", "*", "metadata"},
+       {"connections", "*", "chains"}},
+      [&](const std::vector<std::string>& keys, nlohmann::json&& value) {
+        if (keys.size() == 1) {
+          if (!value.is_number()) return;
+          (keys[0] == "uploadTotal" ? upload_total_ : download_total_) =
+              value.get<double>();
+          return;
+        }
+        const auto& field = keys[2];
+        if (field == "id" && value.is_string()) {
+          entry.id = value.get<std::string>();
+        } else if (field == "upload" && value.is_number()) {
+          entry.upload = value.get<uint64_t>();
+        } else if (field == "download" && value.is_number()) {
+          entry.download = value.get<uint64_t>();
+        } else if (field == "metadata") {
+          entry.metadata = std::move(value);
+        } else if (field == "chains") {
+          entry.chains = std::move(value);
+        }
+      },
+      [&](const std::vector<std::string>& keys) {
+        if (keys.size() == 2) {
+          // the next connection starts, so the previous one is complete
+          merge(entry, seconds);
+          return false;
+        }
+        const bool described =
+            keys.size() == 3 && (keys[2] == "metadata" || keys[2] == "chains");
+        if (described) {
+          return entry.id.empty() || conns_.find(entry.id) == conns_.end();
+        }
+        return true;
+      });
+  if (!nlohmann::json::sax_parse(std::forward<Input>(body), &extractor)) {
+    throw std::invalid_argument("invalid connections: " + extractor.error());
+  }
+  merge(entry, seconds);
+
+  for (auto conn = conns_.begin(); conn != conns_.end();) {
+    if (conn->second.seen != generation_) {
+      conn = conns_.erase(conn);
+      changed_ = true;
+    } else {
+      ++conn;
+    }
+  }
+}
+
+}  // namespace clashctl
+
+/*
+ * Implementation that will be part of the .cpp file if split into .hpp and .cpp
+ * files.
+ */
+
+namespace clashctl {
+
+inline void ConnectionTable::merge(Entry& entry, double seconds) {
+  if (entry.id.empty()) return;
+  auto [conn, inserted] = conns_.try_emplace(entry.id);
+  auto& c = conn->second;
+  if (inserted) {
+    // it opened since the previous snapshot, so everything it moved counts,
+    // unless there is no previous snapshot to tell
+    c.id = conn->first;
+    if (generation_ == 1) {
+      c.upload = entry.upload;
+      c.download = entry.download;
+    }
+    if (!entry.metadata.is_null()) c.host = describe_host(entry.metadata);
+    if (!entry.chains.is_null()) c.chain = describe_chain(entry.chains);
+    changed_ = true;
+  }
+  c.up_rate = (entry.upload - std::min(entry.upload, c.upload)) / seconds;
+  c.down_rate =
+      (entry.download - std::min(entry.download, c.download)) / seconds;
+  c.upload = entry.upload;
+  c.download = entry.download;
+  c.seen = generation_;
+  up_rate_ += c.up_rate;
+  down_rate_ += c.down_rate;
+
+  // the id keeps its memory for the next connection
+  entry.id.clear();
+  entry.upload = entry.download = 0;
+  entry.metadata = nullptr;
+  entry.chains = nullptr;
+}
+
+inline const std::vector<const Connection*>& ConnectionTable::top(size_t n) {
+  if (changed_) {
+    // pointers to the values of an unordered_map stay valid until they are
+    // erased, so the order only needs rebuilding when connections come or go
+    order_.clear();
+    order_.reserve(conns_.size());
+    for (auto&& conn : conns_) order_.push_back(&conn.second);
+    changed_ = false;
+  }
+  n = std::min(n, order_.size());
+  std::partial_sort(order_.begin(), order_.begin() + n, order_.end(),
+                    [](const Connection* a, const Connection* b) {
+                      const double ra = a->up_rate + a->down_rate;
+                      const double rb = b->up_rate + b->down_rate;
+                      if (ra != rb) return ra > rb;
+                      return a->download + a->upload > b->download + b->upload;
+                    });
+  top_.assign(order_.begin(), order_.begin() + n);
+  return top_;
+}
+
+inline std::string ConnectionTable::describe_host(
+    const nlohmann::json& metadata) {
+  auto string = [&](const char* key) -> std::string {
+    auto it = metadata.find(key);
+    if (it == metadata.end()) return "";
+    // some clash versions send ports as numbers
+    if (it->is_number()) return it->dump();
+    return it->is_string() ? it->get<std::string>() : "";
+  };
+  auto host = string("host");
+  if (host.empty()) host = string("destinationIP");
+  const auto port = string("destinationPort");
+  return port.empty() ? host : host + ":" + port;
+}
+
+inline std::string ConnectionTable::describe_chain(
+    const nlohmann::json& chains) {
+  std::string chain;
+  if (!chains.is_array()) return chain;
+  // clash lists the chain from the proxy out to the group
+  for (auto it = chains.rbegin(); it != chains.rend(); ++it) {
+    if (!it->is_string()) continue;
+    if (!chain.empty()) chain += " > ";
+    chain += it->get<std::string>();
+  }
+  return chain;
+}
+
+}  // namespace clashctl
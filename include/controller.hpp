@@ -4,15 +4,37 @@
  * Headers
  */
 
+#include <unistd.h>
+
 #include <algorithm>
+#include <atomic>
+#include <cerrno>
 #include <chrono>
 #include <cstdlib>
 #include <exception>
+#include <fstream>
+#include <istream>
+#include <functional>
+#include <memory>
 #include <optional>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <thread>
+#include <vector>
 
+#include "connections.hpp"
+#include "download.hpp"
+#include "event_log.hpp"
+#include "generations.hpp"
+#include "json_extract.hpp"
+#include "metrics.hpp"
+#include "ndjson.hpp"
+#include "net.hpp"
+#include "pool.hpp"
+#include "proxy_model.hpp"
+#include "rotating_file.hpp"
+#include "supervisor.hpp"
 #include "third-party/nlohmann/json.hpp"
 #include "third-party/yhirose/httplib.h"
 #include "utils.hpp"
@@ -33,92 +55,396 @@ struct Config {
   const std::string clash_exe;
   // the path to the clash server log file
   const std::string clash_log;
-  // the path to the clashctl log file
+  // the path to the file holding the pid of the running clash server
+  const std::string clash_pid;
+  // the path to the marker left by an explicit stop, so the watchdog does
+  // not bring clash back
+  const std::string clash_stopped;
+  // the path to the clashctl log file, events as json lines
   const std::string clashctl_log;
   // the path to the clash config directory
   const std::string clash_config;
-  // the path to the clash config file
+  // the path to the cache of resolved proxy servers
+  const std::string dns_cache;
+  // the path to the last known proxies and groups, to draw menus before
+  // clash answers
+  const std::string proxy_cache;
+  // the path to the geoip database shared with clash
+  const std::string clash_mmdb;
+  // the path to the clash config file, a symlink into clash_generations
   const std::string clash_config_file;
+  // the path to the applied clash config files stored by content hash
+  const std::string clash_generations;
+  // how many applied clash config files to keep
+  const size_t max_generations;
   // the path to the downloaded clash config file
   const std::string update_temp_file;
-  // the proxy endpoint
+  // the path to the url, validators and hash of the last downloaded config
+  const std::string update_meta_file;
+  // the proxy endpoint, overridden by $CLASHCTL_PROXY
   const std::string proxy_endpoint;
-  // the clash server controller endpoint
+  // the clash server controller endpoint, overridden by $CLASHCTL_CONTROLLER
   const std::string controller_endpoint;
-  // the url for getting the final mode
-  const std::string mode_url;
-  // the url for getting the proxies
-  const std::string proxy_url;
+  // the group switching between DIRECT and the proxy group, found
+  // automatically if clash has no such group, overridden by
+  // $CLASHCTL_MODE_GROUP
+  const std::string mode_group;
+  // the group selecting the proxy, found automatically if clash has no such
+  // group, overridden by $CLASHCTL_PROXY_GROUP
+  const std::string proxy_group;
+  // the host:port visited through clash to test the connection, overridden
+  // by $CLASHCTL_PING_ENDPOINT
+  const std::string ping_endpoint;
+  // the url clash visits through a proxy to test its delay
+  const std::string delay_test_url;
+  // the timeout in milliseconds of a single delay test
+  const int delay_timeout;
+  // how long in milliseconds clash may take to exit before it is killed
+  const int stop_timeout;
+  // how long in milliseconds to wait for clash to be ready after starting
+  // it, overridden by $CLASHCTL_READY_TIMEOUT
+  const int ready_timeout;
+  // the path to the socket the daemon answers on
+  const std::string daemon_socket;
+  // how often in milliseconds the daemon fetches the proxies, overridden by
+  // $CLASHCTL_DAEMON_REFRESH
+  const int daemon_refresh;
+  // how often in milliseconds the watchdog checks clash, 0 keeps the daemon
+  // from running one, overridden by $CLASHCTL_WATCHDOG_INTERVAL
+  const int watchdog_interval;
+  // the path to the outages seen by the watchdog
+  const std::string watchdog_stats;
+  // the path to the file locked by the running watchdog
+  const std::string watchdog_lock;
+  // the host:port the daemon serves prometheus metrics on, none if empty,
+  // set by $CLASHCTL_METRICS
+  const std::string metrics_endpoint;
+  // how often in milliseconds the daemon tests the delay of every proxy of
+  // the proxy group for the metrics, 0 for never, overridden by
+  // $CLASHCTL_METRICS_DELAY_INTERVAL
+  const int metrics_delay_interval;
+  // how often in milliseconds auto tests the proxies, overridden by
+  // $CLASHCTL_AUTO_INTERVAL
+  const int auto_interval;
+  // by how many milliseconds a proxy has to beat the current one for auto
+  // to switch to it, overridden by $CLASHCTL_AUTO_MARGIN
+  const int auto_margin;
+  // in how many rounds in a row a proxy has to beat the current one for
+  // auto to switch to it, overridden by $CLASHCTL_AUTO_ROUNDS
+  const int auto_rounds;
+  // the size in bytes at which clash_log and clashctl_log are rotated, 0
+  // for never, overridden in KiB by $CLASHCTL_LOG_MAX_SIZE
+  const size_t log_max_size;
+  // how many rotated files of each log to keep, overridden by
+  // $CLASHCTL_LOG_GENERATIONS
+  const size_t log_generations;
+  // whether rotated logs are gzipped, overridden by $CLASHCTL_LOG_COMPRESS
+  const bool log_compress;
 };
 
-class Mode {
- public:
-  static const std::vector<std::string>& modes() noexcept;
+// timings of a connection test through clash
+struct PingStats {
+  using duration = std::chrono::duration<double, std::milli>;
+  // tcp connect to the proxy port
+  duration connect;
+  // CONNECT request to the tunnel being established
+  duration handshake;
+  // request through the tunnel to the first byte of the response
+  duration first_byte;
+};
 
-  Mode(const std::string& str);
+// telemetry of clash and clashctl, updated without locks by the controller,
+// the watchdog and the daemon, and served by Telemetry
+struct Metrics {
+  Metrics() noexcept;
 
-  std::string str() const noexcept { return std::string(str_); }
+  // all of them in the prometheus text format
+  std::string render() const;
 
- private:
-  std::string_view str_;
+ public:
+  // delay tests through each proxy in seconds
+  quicky::Family<quicky::Histogram> proxy_delay;
+  // delay tests through each proxy that clash answered with a failure
+  quicky::Family<quicky::Counter> proxy_delay_failures;
+  // round trips to the controller in seconds, delay tests left out
+  quicky::Histogram controller_request;
+  quicky::Counter clash_starts;
+  quicky::Counter clash_start_failures;
+  quicky::Counter watchdog_outages;
+  quicky::Counter watchdog_restarts;
+  // sampled from clash and its process every daemon refresh
+  quicky::Gauge clash_up;
+  quicky::Gauge clash_rss_bytes;
+  quicky::Gauge clash_cpu_seconds;
+  quicky::Gauge connections;
+  quicky::Gauge upload_total;
+  quicky::Gauge download_total;
+  // the latest second of /traffic
+  quicky::Gauge upload_rate;
+  quicky::Gauge download_rate;
 };
 
 class Controller {
  public:
-  Controller(Config& config) noexcept : config_(config) {}
+  Controller(Config& config) noexcept
+      : config_(config),
+        pool_(config.controller_endpoint),
+        supervisor_(config.clash_exe, config.clash_pid),
+        generations_(config.clash_generations, config.clash_config_file,
+                     config.max_generations),
+        events_(config.clashctl_log, config.log_max_size,
+                config.log_generations, config.log_compress) {
+    pool_.on_release([this](std::chrono::steady_clock::duration d) {
+      metrics_.controller_request.observe(
+          std::chrono::duration<double>(d).count());
+    });
+  }
 
   // start clash
-  // 1. prepare empty log file for clash
-  // 2. run clash background
+  // 1. run clash background, its output piped into the rotating clash log
+  // 2. wait for clash to be ready
   // 3. connection test
   bool start() const noexcept;
 
   // stop clash
-  // kill clash running background
-  void stop() const noexcept {
-    quicky::kill(config_.clash_exe);
-  }
+  // 1. leave a marker telling the watchdog clash is meant to be down
+  // 2. terminate the clash recorded in the pidfile, or kill clash by name if
+  //    it was started without one
+  void stop() const noexcept;
+
+  // restart clash
+  // stop it without leaving the marker of stop, and start it
+  bool restart() const noexcept;
+
+  // restart clash after it went down, unless it has been stopped explicitly
+  // since, which the watchdog must not undo
+  bool revive() const noexcept;
+
+  // whether the clash started by start is still running
+  bool running() const noexcept { return supervisor_.running(); }
+
+  // whether the controller answers within timeout, which a hung clash does
+  // not although the kernel still accepts its connections
+  bool responsive(std::chrono::milliseconds timeout) const noexcept;
 
   // reload clash
-  // call stop and start
+  // 1. start clash if it is not running
+  // 2. validate the config file
+  // 3. reload the config file in place through the controller
+  // 4. fall back to restart if the in-place reload fails
   bool reload() const noexcept;
 
+  // test a config file with clash without applying it
+  bool validate(const std::string& config_file) const noexcept;
+
+  // poll the controller and the proxy port with exponential backoff until
+  // both answer or the timeout passes
+  // returns how long clash took to be ready, or nullopt on timeout
+  std::optional<std::chrono::milliseconds> wait_ready(
+      std::chrono::milliseconds timeout) const noexcept;
+
   // connection test by visiting google
-  // 1. set http proxy
-  // 2. visit google
-  // 3. unset http proxy
-  bool ping() const noexcept;
+  bool ping() const noexcept { return probe().has_value(); }
+
+  // connection test by visiting google through the proxy port
+  // 1. connect to the proxy port
+  // 2. open a tunnel to google with CONNECT
+  // 3. send a request and wait for the first byte of the response
+  // returns the timing of each step, or nullopt on failure
+  std::optional<PingStats> probe() const noexcept;
 
   // update clash subscription
-  // 1. download config file
-  // 2. backup old config file if exists
-  // 3. apply new config file
-  // 4. test connection by calling reload and ping
-  // 5. stop the clash running for testing
+  // 1. download config file unless it has not been modified
+  // 2. skip the update if the content has not changed
+  // 3. validate config file
+  // 4. store it as a new generation and point the config file at it
+  // 5. test connection by calling reload and ping
+  // 6. stop the clash running for testing if it was not running before
   bool update(const std::string& url) const noexcept;
 
+  // roll back to an earlier config
+  // 1. point the config file at the n-th generation before the active one
+  // 2. reload clash if it is running
+  // the history is left in the order the configs were applied, so rolling
+  // back again goes further back
+  bool rollback(size_t n) const noexcept;
+
+  // applied config generations, the most recent first
+  const Generations& generations() const noexcept { return generations_; }
+
+  // the log of clashctl's own events, written to config.clashctl_log
+  quicky::EventLog& events() const noexcept { return events_; }
+
+  Metrics& metrics() const noexcept { return metrics_; }
+
+  // the pid of the clash started by start, or -1
+  pid_t pid() const noexcept { return supervisor_.pid(); }
+
+  // reap the clash and log sinks started here once they exit, for long
+  // running callers
+  void reap() const noexcept { supervisor_.reap(); }
+
+  // fetch every proxy and group from clash in a single request
+  // the getters below are served from the last snapshot, which is fetched
+  // on first use
+  bool refresh() const noexcept;
+
+  // fetch a snapshot without using it
+  // safe to call from another thread, as it prints nothing and touches
+  // neither the snapshot in use nor the cache
+  std::optional<ProxyModel> fetch_proxies() const noexcept;
+
+  // serve the getters from the snapshot saved by the last fetch, which may
+  // be stale
+  bool load_cached_proxies() const noexcept;
+
+  // serve the getters from a snapshot, and write it to the cache
+  // the cache is only ever written here and by record_selection, by whoever
+  // owns the snapshot
+  void use_proxies(ProxyModel&& model) const noexcept;
+
+  // the snapshot of the proxies and groups, nullopt if it could not be
+  // fetched
+  const std::optional<ProxyModel>& proxy_model() const noexcept;
+
   std::string get_proxy() const noexcept;
 
   std::optional<std::vector<std::string>> get_proxies() const;
 
   bool set_proxy(const std::string& proxy) const noexcept;
 
+  // ask clash to test the delay of a proxy
+  // returns the delay in milliseconds, or nullopt on timeout or error
+  std::optional<int> get_delay(const std::string& proxy) const noexcept;
+
   std::string get_mode() const noexcept;
 
+  // the members of the mode group
+  std::optional<std::vector<std::string>> get_modes() const;
+
   bool set_mode(const std::string& mode) const noexcept;
 
+  // set_proxy and set_mode in steps, for a caller guarding the snapshot
+  // with a lock it does not want to hold over the round trip to clash:
+  // 1. selector gives the group to select the proxy or the mode in, empty
+  //    if the snapshot has none, under the lock
+  // 2. put_selection asks clash, touching nothing but the pool
+  // 3. record_selection updates the snapshot and rewrites the cache, so
+  //    menus reading it see the selection, under the lock again
+  std::string selector(bool mode) const noexcept;
+
+  bool put_selection(const std::string& group, const std::string& name,
+                     const char* what) const noexcept;
+
+  void record_selection(const std::string& group,
+                        const std::string& name) const noexcept;
+
+  // one line for status bars, the proxy and its last delay, or the mode if
+  // it does not go through the proxy group
+  // empty if the proxies could not be fetched
+  std::string status() const noexcept;
+
+  // merge the open connections listed by /connections into table, parsed as
+  // they are received, `elapsed` after the previous call
+  // returns false if they could not be fetched or parsed
+  bool get_connections(ConnectionTable& table,
+                       std::chrono::duration<double> elapsed) const noexcept;
+
+  // close connections by id, concurrently over the pool
+  // returns how many were closed
+  size_t close_connections(const std::vector<std::string>& ids) const noexcept;
+
+  // follow a streaming endpoint such as /traffic or /logs on a connection of
+  // its own, calling fn with every json line as it arrives
+  // the line is only valid during the call, return false to stop
+  // returns false if the stream could not be opened or broke off, and true
+  // once fn stops it
+  bool stream(const std::string& path,
+              const std::function<bool(std::string_view)>& fn,
+              std::chrono::seconds idle_timeout = std::chrono::seconds(5)) const
+      noexcept;
+
  private:
-  bool rm_log() const noexcept;
+  // GET path and parse the body on a thread of its own as it arrives, so
+  // neither the whole body nor a document of it is ever held in memory
+  // returns nullopt if the request or parse fails
+  template <class T>
+  std::optional<T> fetch_streamed(
+      const std::string& path,
+      const std::function<T(std::istream&)>& parse) const noexcept;
 
-  bool touch_log() const noexcept {
-    return quicky::run("touch " + config_.clash_log) == 0;
-  }
+  // serve the getters from a snapshot, without writing it to the cache
+  void adopt_proxies(ProxyModel&& model) const noexcept;
+
+  // select a member of a group in the snapshot
+  bool select(std::optional<size_t> group, const std::string& name,
+              const char* what) const noexcept;
+
+  // ask the running clash to load the config file in place, keeping its
+  // connections alive
+  bool hot_reload() const noexcept;
+
+  // stop clash without leaving the marker of stop
+  void halt() const noexcept;
+
+  // start clash without clearing the marker of stop
+  bool launch() const noexcept;
+
+  // copy clash output from fd into the rotating clash log until it closes
+  void write_log(int fd) const noexcept;
 
  private:
   Config& config_;
+  // keep-alive connections to the controller shared by all calls
+  mutable quicky::ClientPool pool_;
+  quicky::Supervisor supervisor_;
+  Generations generations_;
+  mutable std::optional<ProxyModel> model_;
+  mutable std::optional<size_t> proxy_group_;
+  mutable std::optional<size_t> mode_group_;
+  mutable quicky::EventLog events_;
+  mutable Metrics metrics_;
 };
 }  // namespace clashctl
 
+/*
+ * Implementation of template methods.
+ */
+
+namespace clashctl {
+
+template <class T>
+std::optional<T> Controller::fetch_streamed(
+    const std::string& path,
+    const std::function<T(std::istream&)>& parse) const noexcept {
+  quicky::ChunkStreamBuf buf;
+  std::optional<T> result;
+  std::thread parser([&]() {
+    std::istream in(&buf);
+    try {
+      result = parse(in);
+    } catch (const std::exception& e) {
+    }
+    buf.done();
+  });
+
+  bool received = false;
+  try {
+    auto cli = pool_.acquire();
+    auto res = cli->Get(
+        path, [](const httplib::Response& res) { return res.status == 200; },
+        [&](const char* data, size_t size) { return buf.push(data, size); });
+    received = res && res->status == 200;
+  } catch (const std::exception& e) {
+  }
+  buf.close();
+  parser.join();
+  if (!received) return std::nullopt;
+  return result;
+}
+
+}  // namespace clashctl
+
 /*
  * Implementation that will be part of the .cpp file if split into .hpp and .cpp
  * files.
@@ -130,81 +456,324 @@ inline Config::Config() noexcept
     : clash_path(std::string(getenv("HOME")) + "/clashctl"),
       clash_exe(clash_path + "/clashctl-buildin-server"),
       clash_log(clash_path + "/clash.log"),
+      clash_pid(clash_path + "/clash.pid"),
+      clash_stopped(clash_path + "/clash.stopped"),
       clashctl_log(clash_path + "/clashctl.log"),
       clash_config(clash_path + "/config"),
+      dns_cache(clash_path + "/dns.cache"),
+      proxy_cache(clash_path + "/proxies.cache"),
+      clash_mmdb(clash_config + "/Country.mmdb"),
       clash_config_file(clash_config + "/config.yaml"),
+      clash_generations(clash_config + "/generations"),
+      max_generations(10),
       update_temp_file(clash_path + "/update.yaml"),
-      proxy_endpoint("127.0.0.1:7890"),
-      controller_endpoint("localhost:9090"),
-      mode_url("/proxies/Final"),
-      proxy_url("/proxies/Proxies") {}
+      update_meta_file(clash_path + "/update.json"),
+      proxy_endpoint(quicky::getenv_str("CLASHCTL_PROXY", "127.0.0.1:7890")),
+      controller_endpoint(
+          quicky::getenv_str("CLASHCTL_CONTROLLER", "localhost:9090")),
+      mode_group(quicky::getenv_str("CLASHCTL_MODE_GROUP", "Final")),
+      proxy_group(quicky::getenv_str("CLASHCTL_PROXY_GROUP", "Proxies")),
+      ping_endpoint(
+          quicky::getenv_str("CLASHCTL_PING_ENDPOINT", "google.com:80")),
+      delay_test_url("http://www.gstatic.com/generate_204"),
+      delay_timeout(5000),
+      stop_timeout(3000),
+      ready_timeout(quicky::getenv_int("CLASHCTL_READY_TIMEOUT", 10000)),
+      daemon_socket(clash_path + "/clashctl.sock"),
+      daemon_refresh(quicky::getenv_int("CLASHCTL_DAEMON_REFRESH", 5000)),
+      watchdog_interval(
+          quicky::getenv_int("CLASHCTL_WATCHDOG_INTERVAL", 5000)),
+      watchdog_stats(clash_path + "/watchdog.json"),
+      watchdog_lock(clash_path + "/watchdog.lock"),
+      metrics_endpoint(quicky::getenv_str("CLASHCTL_METRICS", "")),
+      metrics_delay_interval(
+          quicky::getenv_int("CLASHCTL_METRICS_DELAY_INTERVAL", 60000)),
+      auto_interval(
+          std::max(1000, quicky::getenv_int("CLASHCTL_AUTO_INTERVAL", 30000))),
+      auto_margin(std::max(0, quicky::getenv_int("CLASHCTL_AUTO_MARGIN", 50))),
+      auto_rounds(std::max(1, quicky::getenv_int("CLASHCTL_AUTO_ROUNDS", 3))),
+      log_max_size(static_cast<size_t>(std::max(
+                       0, quicky::getenv_int("CLASHCTL_LOG_MAX_SIZE", 10240))) *
+                   1024),
+      log_generations(static_cast<size_t>(
+          std::max(0, quicky::getenv_int("CLASHCTL_LOG_GENERATIONS", 3)))),
+      log_compress(quicky::getenv_int("CLASHCTL_LOG_COMPRESS", 1) != 0) {}
 
-inline const std::vector<std::string>& Mode::modes() noexcept {
-  static std::vector<std::string> modes_ = {"DIRECT", "Proxies"};
-  return modes_;
-}
+inline Metrics::Metrics() noexcept
+    : proxy_delay("proxy", 1024,
+                  []() {
+                    return std::make_unique<quicky::Histogram>(
+                        std::vector<double>{0.05, 0.1, 0.2, 0.3, 0.5, 0.75, 1,
+                                            2, 5});
+                  }),
+      proxy_delay_failures(
+          "proxy", 1024, []() { return std::make_unique<quicky::Counter>(); }),
+      controller_request({0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1,
+                          0.25, 0.5, 1}) {}
 
-inline Mode::Mode(const std::string& str) {
-  const auto& modes_ = modes();
-  auto it = std::find(modes_.begin(), modes_.end(), str);
-  if (it == modes_.end()) {
-    throw std::logic_error("invalid mode string.");
-  }
-  str_ = *it;
+inline std::string Metrics::render() const {
+  using quicky::write_metric_header;
+  std::string out;
+  write_metric_header(out, "clash_proxy_delay_seconds", "histogram",
+                      "Delay tests through each proxy.");
+  proxy_delay.write(out, "clash_proxy_delay_seconds");
+  write_metric_header(out, "clash_proxy_delay_failures_total", "counter",
+                      "Delay tests through each proxy that failed.");
+  proxy_delay_failures.write(out, "clash_proxy_delay_failures_total");
+  write_metric_header(out, "clash_up", "gauge",
+                      "Whether the clash started by clashctl is running.");
+  clash_up.write(out, "clash_up");
+  write_metric_header(out, "clash_resident_memory_bytes", "gauge",
+                      "Resident memory of the clash process.");
+  clash_rss_bytes.write(out, "clash_resident_memory_bytes");
+  write_metric_header(out, "clash_cpu_seconds_total", "counter",
+                      "User and system cpu time of the clash process.");
+  clash_cpu_seconds.write(out, "clash_cpu_seconds_total");
+  write_metric_header(out, "clash_connections", "gauge",
+                      "Connections open through clash.");
+  connections.write(out, "clash_connections");
+  write_metric_header(out, "clash_upload_bytes_total", "counter",
+                      "Bytes uploaded through clash since it started.");
+  upload_total.write(out, "clash_upload_bytes_total");
+  write_metric_header(out, "clash_download_bytes_total", "counter",
+                      "Bytes downloaded through clash since it started.");
+  download_total.write(out, "clash_download_bytes_total");
+  write_metric_header(out, "clash_upload_bytes_per_second", "gauge",
+                      "Upload rate through clash.");
+  upload_rate.write(out, "clash_upload_bytes_per_second");
+  write_metric_header(out, "clash_download_bytes_per_second", "gauge",
+                      "Download rate through clash.");
+  download_rate.write(out, "clash_download_bytes_per_second");
+  write_metric_header(out, "clashctl_clash_starts_total", "counter",
+                      "Times clash was started and got ready.");
+  clash_starts.write(out, "clashctl_clash_starts_total");
+  write_metric_header(out, "clashctl_clash_start_failures_total", "counter",
+                      "Times clash failed to start or get ready.");
+  clash_start_failures.write(out, "clashctl_clash_start_failures_total");
+  write_metric_header(out, "clashctl_watchdog_outages_total", "counter",
+                      "Outages of clash noticed by the watchdog.");
+  watchdog_outages.write(out, "clashctl_watchdog_outages_total");
+  write_metric_header(out, "clashctl_watchdog_restarts_total", "counter",
+                      "Restarts of clash by the watchdog.");
+  watchdog_restarts.write(out, "clashctl_watchdog_restarts_total");
+  write_metric_header(out, "clashctl_controller_request_seconds", "histogram",
+                      "Round trips to the clash controller.");
+  controller_request.write(out, "clashctl_controller_request_seconds");
+  return out;
 }
 
 // start clash
-// 1. prepare empty log file for clash
-// 2. run clash background
+// 1. run clash background, its output piped into the rotating clash log
+// 2. wait for clash to be ready
 // 3. connection test
 inline bool Controller::start() const noexcept {
-  if (!rm_log() || !touch_log()) {
-    quicky::errorln("failed to prepare log file.");
-    return false;
-  }
+  // wanted up again, the watchdog may bring it back from now on
+  unlink(config_.clash_stopped.c_str());
+  return launch();
+}
+
+inline bool Controller::launch() const noexcept {
   quicky::info() << "starting clash server." << std::endl;
-  if (quicky::run_background(config_.clash_exe + " -d " + config_.clash_config,
-                             config_.clash_log)) {
+  const std::vector<std::string> args = {"-d", config_.clash_config};
+  bool started =
+      supervisor_.start(args, [this](int fd) { write_log(fd); });
+  if (!started) {
+    // without rotation rather than not at all
+    started = supervisor_.start(args, config_.clash_log);
+  }
+  if (!started) {
     quicky::errorln("failed to start clash server.");
+    metrics_.clash_start_failures.inc();
+    events_.error("clash.start", {{"error", "spawn failed"}});
     return false;
   }
+  auto elapsed = wait_ready(std::chrono::milliseconds(config_.ready_timeout));
+  if (!elapsed.has_value()) {
+    quicky::errorln("clash server did not get ready in time.");
+    metrics_.clash_start_failures.inc();
+    events_.error("clash.start", {{"error", "not ready"},
+                                  {"timeout_ms", config_.ready_timeout}});
+    halt();
+    return false;
+  }
+  quicky::info() << "clash server is ready after " << elapsed->count() << "ms."
+                 << std::endl;
   if (!ping()) {
     quicky::errorln("clash is not available.");
-    stop();
+    metrics_.clash_start_failures.inc();
+    events_.error("clash.start", {{"error", "ping failed"},
+                                  {"ready_ms", elapsed->count()}});
+    halt();
     return false;
   }
+  metrics_.clash_starts.inc();
+  events_.info("clash.start", {{"pid", supervisor_.pid()},
+                               {"ready_ms", elapsed->count()}});
   return true;
 }
 
+// stop clash
+// 1. leave a marker telling the watchdog clash is meant to be down
+// 2. terminate the clash recorded in the pidfile, or kill clash by name if
+//    it was started without one
+inline void Controller::stop() const noexcept {
+  std::ofstream(config_.clash_stopped, std::ios::trunc);
+  halt();
+}
+
+inline void Controller::halt() const noexcept {
+  const bool tracked = quicky::exists(config_.clash_pid);
+  if (supervisor_.stop(std::chrono::milliseconds(config_.stop_timeout))) {
+    events_.info("clash.stop");
+  } else if (!tracked) {
+    quicky::kill(config_.clash_exe);
+  }
+}
+
+// restart clash
+// stop it without leaving the marker of stop, and start it
+inline bool Controller::restart() const noexcept {
+  halt();
+  return start();
+}
+
+inline bool Controller::revive() const noexcept {
+  if (quicky::exists(config_.clash_stopped)) return false;
+  halt();
+  return launch();
+}
+
 // reload clash
-// call stop and start
+// 1. start clash if it is not running
+// 2. validate the config file
+// 3. reload the config file in place through the controller
+// 4. fall back to restart if the in-place reload fails
 inline bool Controller::reload() const noexcept {
-  stop();
-  return start();
+  if (!supervisor_.running()) return restart();
+  if (!validate(config_.clash_config_file)) {
+    quicky::errorln("invalid config file, keeping the running clash.");
+    return false;
+  }
+  if (hot_reload()) {
+    events_.info("clash.reload", {{"in_place", true}});
+    return true;
+  }
+  quicky::infoln("failed to reload clash in place, restarting it.");
+  events_.error("clash.reload", {{"in_place", false}});
+  return restart();
+}
+
+inline bool Controller::validate(
+    const std::string& config_file) const noexcept {
+  return quicky::run(config_.clash_exe + " -t -d " + config_.clash_config +
+                     " -f " + config_file) == 0;
+}
+
+inline std::optional<std::chrono::milliseconds> Controller::wait_ready(
+    std::chrono::milliseconds timeout) const noexcept {
+  using clock = std::chrono::steady_clock;
+  const auto begin = clock::now();
+  const auto deadline = begin + timeout;
+  const auto [proxy_host, proxy_port] =
+      quicky::split_host_port(config_.proxy_endpoint);
+  auto backoff = std::chrono::milliseconds(5);
+  bool controller_ready = false;
+
+  while (true) {
+    if (!controller_ready) {
+      try {
+        auto cli = pool_.acquire();
+        auto res = cli->Get("/version");
+        controller_ready = res && res->status == 200;
+      } catch (const std::exception& e) {
+      }
+    }
+    if (controller_ready &&
+        quicky::Socket::connect(proxy_host, proxy_port, backoff).valid()) {
+      return std::chrono::duration_cast<std::chrono::milliseconds>(
+          clock::now() - begin);
+    }
+
+    const auto now = clock::now();
+    if (now >= deadline) return std::nullopt;
+    std::this_thread::sleep_for(
+        std::min<clock::duration>(backoff, deadline - now));
+    backoff = std::min(backoff * 2, std::chrono::milliseconds(250));
+  }
+}
+
+inline bool Controller::responsive(
+    std::chrono::milliseconds timeout) const noexcept {
+  try {
+    // a connection of its own, a probe must neither wait behind a pooled
+    // connection stuck on a hung clash nor leave its timeouts on one
+    httplib::Client cli(config_.controller_endpoint);
+    cli.set_connection_timeout(timeout);
+    cli.set_read_timeout(timeout);
+    cli.set_write_timeout(timeout);
+    auto res = cli.Get("/version");
+    return res && res->status == 200;
+  } catch (const std::exception& e) {
+    return false;
+  }
 }
 
-// connection test by visiting google
-// 1. set http proxy
-// 2. visit google
-// 3. unset http proxy
-inline bool Controller::ping() const noexcept {
-  std::this_thread::sleep_for(std::chrono::seconds(1));
-  setenv("http_proxy", config_.proxy_endpoint.c_str(), 1);
-  setenv("https_proxy", config_.proxy_endpoint.c_str(), 1);
+// connection test by visiting google through the proxy port
+// 1. connect to the proxy port
+// 2. open a tunnel to google with CONNECT
+// 3. send a request and wait for the first byte of the response
+inline std::optional<PingStats> Controller::probe() const noexcept {
+  using clock = std::chrono::steady_clock;
+  constexpr auto timeout = std::chrono::seconds(2);
+  const auto [proxy_host, proxy_port] =
+      quicky::split_host_port(config_.proxy_endpoint);
+  const auto host = quicky::split_host_port(config_.ping_endpoint).first;
+  PingStats stats;
+  char buf[512];
 
-  int res = quicky::run("curl -s --connect-timeout 2 google.com");
+  auto begin = clock::now();
+  auto sock = quicky::Socket::connect(proxy_host, proxy_port, timeout);
+  if (!sock.valid()) return std::nullopt;
+  stats.connect = clock::now() - begin;
 
-  setenv("http_proxy", "", 1);
-  setenv("https_proxy", "", 1);
-  return res == 0;
+  begin = clock::now();
+  if (!sock.send_all("CONNECT " + config_.ping_endpoint + " HTTP/1.1\r\n"
+                     "Host: " + config_.ping_endpoint + "\r\n\r\n",
+                     timeout)) {
+    return std::nullopt;
+  }
+  std::string head;
+  while (head.find("\r\n\r\n") == std::string::npos) {
+    const auto n = sock.recv_some(buf, sizeof(buf), timeout);
+    if (n <= 0 || head.size() > 4096) return std::nullopt;
+    head.append(buf, n);
+  }
+  // "HTTP/1.x 200 ..."
+  if (head.compare(0, 5, "HTTP/") != 0 || head.size() < 12 ||
+      head.compare(9, 3, "200") != 0) {
+    return std::nullopt;
+  }
+  stats.handshake = clock::now() - begin;
+
+  begin = clock::now();
+  if (!sock.send_all("HEAD / HTTP/1.1\r\nHost: " + host +
+                     "\r\nConnection: close\r\n\r\n",
+                     timeout)) {
+    return std::nullopt;
+  }
+  const auto n = sock.recv_some(buf, sizeof(buf), timeout);
+  if (n <= 0) return std::nullopt;
+  stats.first_byte = clock::now() - begin;
+  return stats;
 }
 
 // update clash subscription
-// 1. download config file
-// 2. backup old config file if exists
-// 3. apply new config file
-// 4. test connection by calling reload and ping
-// 5. stop the clash running for testing
+// 1. download config file unless it has not been modified
+// 2. skip the update if the content has not changed
+// 3. validate config file
+// 4. store it as a new generation and point the config file at it
+// 5. test connection by calling reload and ping
+// 6. stop the clash running for testing if it was not running before
 inline bool Controller::update(const std::string& url) const noexcept {
   auto& update_file = config_.update_temp_file;
   auto& config_file = config_.clash_config_file;
@@ -214,130 +783,365 @@ inline bool Controller::update(const std::string& url) const noexcept {
     return false;
   }
 
-  setenv("http_proxy", "", 1);
-  setenv("https_proxy", "", 1);
-  if (quicky::download_file(quicky::trim_url(url), update_file)) {
+  const auto trimmed_url = quicky::trim_url(url);
+  quicky::Validators cached;
+  nlohmann::json meta;
+  try {
+    std::ifstream f(config_.update_meta_file);
+    if (f) meta = nlohmann::json::parse(f);
+    // only revalidate the config that is still in use, not one rolled back
+    // from
+    const auto hash = meta.value("sha256", "");
+    if (meta.value("url", "") == trimmed_url && !hash.empty() &&
+        hash == generations_.current() && quicky::exists(config_file)) {
+      cached.etag = meta.value("etag", "");
+      cached.last_modified = meta.value("last_modified", "");
+    }
+  } catch (const std::exception& e) {
+    meta = nlohmann::json::object();
+  }
+
+  auto download = quicky::download(trimmed_url, update_file, cached);
+  if (!download.has_value()) {
     quicky::errorln("failed to download config file.");
     return false;
   }
+  meta["url"] = trimmed_url;
+  meta["etag"] = download->validators.etag;
+  meta["last_modified"] = download->validators.last_modified;
+  auto save_meta = [&]() {
+    std::ofstream f(config_.update_meta_file, std::ios::trunc);
+    f << meta.dump(2) << std::endl;
+  };
 
-  if (quicky::exists(config_file)) {
-    quicky::infoln("backing up old config file.");
-    if (!quicky::cp(config_file, config_file + ".backup")) {
-      quicky::errorln("failed to backup old config file.");
-      return false;
-    }
+  if (download->status == 304) {
+    quicky::infoln("config file has not been modified.");
+    return true;
+  }
+  meta["sha256"] = download->sha256;
+  if (!generations_.import_config()) {
+    quicky::errorln("failed to store old config file.");
+    return false;
+  }
+  const auto previous = generations_.current();
+  if (previous == download->sha256) {
+    quicky::infoln("config file has not changed.");
+    quicky::rm(update_file);
+    save_meta();
+    return true;
+  }
+
+  if (!validate(update_file)) {
+    quicky::errorln("downloaded config file is invalid.");
+    quicky::rm(update_file);
+    return false;
   }
 
   quicky::infoln("updating config file.");
-  if (!quicky::cp(update_file, config_file)) {
+  auto hash = generations_.store(update_file, download->sha256);
+  if (!hash.has_value() || !generations_.activate(*hash)) {
     quicky::errorln("failed to update config file.");
+    if (hash.has_value()) generations_.discard(*hash);
     return false;
   }
 
   quicky::infoln("testing new config file.");
+  const bool was_running = supervisor_.running();
   if (!reload() || !ping()) {
     quicky::errorln("invalid config file. recovering old config file.");
-    if (quicky::exists(config_file + ".backup")) {
-      if (!quicky::cp(config_file + ".backup", config_file)) {
-        quicky::errorln("failed to recover old config file.");
-      }
+    if (!previous.empty() && !generations_.activate(previous)) {
+      quicky::errorln("failed to recover old config file.");
+    } else {
+      generations_.discard(*hash);
+    }
+    if (was_running) {
+      reload();
+    } else {
+      stop();
     }
-    stop();
     return false;
   }
-  stop();
+  if (!was_running) stop();
+  generations_.record(*hash);
+  save_meta();
   return true;
 }
 
-inline std::string Controller::get_proxy() const noexcept {
+// roll back to an earlier config
+// 1. point the config file at the n-th generation before the active one
+// 2. reload clash if it is running
+inline bool Controller::rollback(size_t n) const noexcept {
+  if (!generations_.import_config()) {
+    quicky::errorln("failed to store old config file.");
+    return false;
+  }
+  const auto history = generations_.history();
+  const auto current = generations_.current();
+  // the active generation is the cursor, the most recent if it is not kept
+  const auto it = std::find(history.begin(), history.end(), current);
+  const size_t from = it == history.end() ? 0 : it - history.begin();
+  if (from + n >= history.size()) {
+    quicky::error() << "only " << history.size() - from - 1
+                    << " generations older than the current one are kept."
+                    << std::endl;
+    return false;
+  }
+  const auto& target = history[from + n];
+  if (!generations_.activate(target)) {
+    quicky::errorln("failed to switch config file.");
+    return false;
+  }
+  if (supervisor_.running() && !reload()) {
+    quicky::errorln("failed to reload clash. recovering config file.");
+    if (!current.empty()) generations_.activate(current);
+    return false;
+  }
+  return true;
+}
+
+inline bool Controller::refresh() const noexcept {
+  auto model = fetch_proxies();
+  if (!model.has_value()) {
+    quicky::errorln("failed to get proxies from clash.");
+    model_.reset();
+    return false;
+  }
+  use_proxies(std::move(*model));
+  return true;
+}
+
+inline std::optional<ProxyModel> Controller::fetch_proxies() const noexcept {
   try {
-    httplib::Client cli(config_.controller_endpoint);
-    auto res = cli.Get(config_.proxy_url);
-    if (!res) {
-      throw std::logic_error("failed to send request to get proxy.");
-    }
-    auto j = nlohmann::json::parse(res->body);
-    return j["now"].get<std::string>();
+    auto model = fetch_streamed<ProxyModel>(
+        "/proxies", [](std::istream& in) { return ProxyModel::parse(in); });
+    return model;
   } catch (const std::exception& e) {
-    quicky::errorln(e.what());
-    return "";
+    return std::nullopt;
+  }
+}
+
+inline bool Controller::load_cached_proxies() const noexcept {
+  auto model = ProxyModel::load(config_.proxy_cache);
+  if (!model.has_value()) return false;
+  adopt_proxies(std::move(*model));
+  return true;
+}
+
+inline void Controller::use_proxies(ProxyModel&& model) const noexcept {
+  model.save(config_.proxy_cache);
+  adopt_proxies(std::move(model));
+}
+
+inline void Controller::adopt_proxies(ProxyModel&& model) const noexcept {
+  model_ = std::move(model);
+  proxy_group_ = model_->proxy_group(config_.proxy_group);
+  mode_group_.reset();
+  if (proxy_group_.has_value()) {
+    mode_group_ = model_->mode_group(config_.mode_group, *proxy_group_);
   }
 }
 
+inline const std::optional<ProxyModel>& Controller::proxy_model() const
+    noexcept {
+  if (!model_.has_value()) refresh();
+  return model_;
+}
+
+inline std::string Controller::get_proxy() const noexcept {
+  if (!proxy_model().has_value() || !proxy_group_.has_value()) return "";
+  return (*model_)[*proxy_group_].now;
+}
+
 inline std::optional<std::vector<std::string>> Controller::get_proxies() const {
+  if (!proxy_model().has_value() || !proxy_group_.has_value()) {
+    return std::nullopt;
+  }
+  return model_->members(*proxy_group_);
+}
+
+inline bool Controller::set_proxy(const std::string& proxy) const noexcept {
+  proxy_model();
+  return select(proxy_group_, proxy, "proxy");
+}
+
+inline std::optional<int> Controller::get_delay(
+    const std::string& proxy) const noexcept {
   try {
-    httplib::Client cli(config_.controller_endpoint);
-    auto res = cli.Get(config_.proxy_url);
-    if (!res) {
-      throw std::logic_error("failed to send request to get proxies.");
+    const std::string path =
+        "/proxies/" + quicky::encode_uri_component(proxy) +
+        "/delay?timeout=" + std::to_string(config_.delay_timeout) +
+        "&url=" + quicky::encode_uri_component(config_.delay_test_url);
+    auto cli = pool_.acquire();
+    cli.untimed();
+    cli->set_read_timeout(
+        std::chrono::milliseconds(config_.delay_timeout + 1000));
+    auto res = cli->Get(path);
+    if (!res) return std::nullopt;
+    if (res->status != 200) {
+      metrics_.proxy_delay_failures.at(proxy).inc();
+      return std::nullopt;
     }
     auto j = nlohmann::json::parse(res->body);
-    return j["all"].get<std::vector<std::string>>();
+    const int delay = j["delay"].get<int>();
+    metrics_.proxy_delay.at(proxy).observe(delay / 1000.0);
+    return delay;
   } catch (const std::exception& e) {
-    quicky::errorln(e.what());
     return std::nullopt;
   }
 }
 
-inline bool Controller::set_proxy(const std::string& proxy) const noexcept {
+inline std::string Controller::get_mode() const noexcept {
+  if (!proxy_model().has_value() || !mode_group_.has_value()) return "";
+  return (*model_)[*mode_group_].now;
+}
+
+inline std::optional<std::vector<std::string>> Controller::get_modes() const {
+  if (!proxy_model().has_value() || !mode_group_.has_value()) {
+    return std::nullopt;
+  }
+  return model_->members(*mode_group_);
+}
+
+inline bool Controller::set_mode(const std::string& mode) const noexcept {
+  proxy_model();
+  return select(mode_group_, mode, "mode");
+}
+
+inline std::string Controller::status() const noexcept {
+  const auto proxy = get_proxy();
+  if (proxy.empty()) return "";
+  const auto mode = get_mode();
+  if (!mode.empty() && mode != (*model_)[*proxy_group_].name) return mode;
+  auto delay = model_->last_delay(proxy);
+  if (!delay.has_value()) return proxy;
+  return proxy + " " + std::to_string(*delay) + "ms";
+}
+
+inline bool Controller::select(std::optional<size_t> group,
+                               const std::string& name,
+                               const char* what) const noexcept {
+  if (!model_.has_value() || !group.has_value()) {
+    quicky::error() << "no group to set " << what << " with." << std::endl;
+    return false;
+  }
+  if (!put_selection((*model_)[*group].name, name, what)) return false;
+  model_->select(*group, name);
+  return true;
+}
+
+inline std::string Controller::selector(bool mode) const noexcept {
+  const auto& group = mode ? mode_group_ : proxy_group_;
+  if (!model_.has_value() || !group.has_value()) return "";
+  return (*model_)[*group].name;
+}
+
+inline bool Controller::put_selection(const std::string& group,
+                                      const std::string& name,
+                                      const char* what) const noexcept {
   try {
-    const std::string data = "{\"name\": \"" + proxy + "\"}";
-    httplib::Client cli(config_.controller_endpoint);
-    auto res = cli.Put(config_.proxy_url, data, "text/plain");
+    nlohmann::json body;
+    body["name"] = name;
+    auto cli = pool_.acquire();
+    auto res = cli->Put("/proxies/" + quicky::encode_uri_component(group),
+                        body.dump(), "application/json");
     if (!res) {
-      quicky::errorln("failed to send request to set proxy.");
+      quicky::error() << "failed to send request to set " << what << "."
+                      << std::endl;
       return false;
     }
-    if (get_proxy() != proxy) return false;
-
+    // clash answers 204 once the selection is applied
+    if (res->status / 100 != 2) return false;
   } catch (const std::exception& e) {
     quicky::errorln(e.what());
-    quicky::errorln("failed to set proxy.");
+    quicky::error() << "failed to set " << what << "." << std::endl;
     return false;
   }
   return true;
 }
 
-inline std::string Controller::get_mode() const noexcept {
+inline void Controller::record_selection(
+    const std::string& group, const std::string& name) const noexcept {
+  // the snapshot may have been replaced meanwhile
+  if (!model_.has_value()) return;
+  const auto i = model_->find(group);
+  if (!i.has_value()) return;
+  model_->select(*i, name);
+  model_->save(config_.proxy_cache);
+}
+
+inline bool Controller::get_connections(
+    ConnectionTable& table, std::chrono::duration<double> elapsed) const
+    noexcept {
+  auto parsed =
+      fetch_streamed<bool>("/connections", [&](std::istream& in) {
+        table.update(in, elapsed);
+        return true;
+      });
+  return parsed.has_value();
+}
+
+inline size_t Controller::close_connections(
+    const std::vector<std::string>& ids) const noexcept {
+  std::atomic<size_t> closed{0};
+  quicky::parallel_for(ids.size(), 8, [&](size_t i) {
+    try {
+      auto cli = pool_.acquire();
+      auto res = cli->Delete("/connections/" +
+                             quicky::encode_uri_component(ids[i]));
+      if (res && res->status / 100 == 2) ++closed;
+    } catch (const std::exception& e) {
+    }
+  });
+  return closed;
+}
+
+inline bool Controller::stream(const std::string& path,
+                               const std::function<bool(std::string_view)>& fn,
+                               std::chrono::seconds idle_timeout) const
+    noexcept {
   try {
+    // a stream holds its connection for as long as it runs, so it does not
+    // take one from the pool
     httplib::Client cli(config_.controller_endpoint);
-    auto res = cli.Get(config_.mode_url);
-    if (!res) {
-      throw std::logic_error("failed to send request to get mode.");
-    }
-    auto j = nlohmann::json::parse(res->body);
-    return Mode(j["now"].get<std::string>()).str();
+    cli.set_read_timeout(idle_timeout);
+    quicky::LineSplitter lines;
+    bool stopped = false;
+    cli.Get(
+        path, [](const httplib::Response& res) { return res.status == 200; },
+        [&](const char* data, size_t size) {
+          stopped = !lines.feed(data, size, fn);
+          return !stopped;
+        });
+    return stopped;
   } catch (const std::exception& e) {
     quicky::errorln(e.what());
-    return "";
+    return false;
   }
 }
 
-inline bool Controller::set_mode(const std::string& mode) const noexcept {
+inline bool Controller::hot_reload() const noexcept {
   try {
-    const std::string data = "{\"name\": \"" + mode + "\"}";
-    httplib::Client cli(config_.controller_endpoint);
-    auto res = cli.Put(config_.mode_url, data, "text/plain");
-    if (!res) {
-      quicky::errorln("failed to send request to set mode.");
-      return false;
-    }
-    if (get_mode() != mode) return false;
-
+    nlohmann::json body;
+    body["path"] = config_.clash_config_file;
+    auto cli = pool_.acquire();
+    auto res = cli->Put("/configs?force=true", body.dump(), "application/json");
+    return res && res->status / 100 == 2;
   } catch (const std::exception& e) {
     quicky::errorln(e.what());
-    quicky::errorln("failed to set mode");
     return false;
   }
-  return true;
 }
 
-inline bool Controller::rm_log() const noexcept {
-  if (quicky::exists(config_.clash_log)) {
-    if (!quicky::rm(config_.clash_log)) return false;
+inline void Controller::write_log(int fd) const noexcept {
+  quicky::RotatingFile log(config_.clash_log, config_.log_max_size,
+                           config_.log_generations, config_.log_compress);
+  char buf[1 << 16];
+  while (true) {
+    const ssize_t n = read(fd, buf, sizeof(buf));
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return;
+    log.write(std::string_view(buf, n));
   }
-  return true;
 }
 
 }  // namespace clashctl
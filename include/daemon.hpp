@@ -0,0 +1,282 @@
+#pragma once
+
+/*
+ * Headers
+ */
+
+#include <signal.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "controller.hpp"
+#include "net.hpp"
+#include "telemetry.hpp"
+#include "third-party/nlohmann/json.hpp"
+#include "third-party/yhirose/httplib.h"
+#include "utils.hpp"
+#include "watchdog.hpp"
+
+/*
+ * Declaration
+ */
+
+namespace clashctl {
+
+// what the daemon answered, the output of the command and whether it worked
+struct Reply {
+  bool ok = false;
+  std::string out;
+};
+
+// a long running clashctl holding the controller connections and the proxy
+// model, which it keeps fetching in the background, so one-shot commands
+// are answered from memory over a unix domain socket
+// it also runs the watchdog, unless config.watchdog_interval is 0, and
+// serves metrics if config.metrics_endpoint is set
+// a request is a json array of the command and its arguments on a line, the
+// reply a json object {"ok", "out"} on a line, one per connection
+// clients are served by a few workers, so a slow client or a slow clash
+// does not hold up the others
+// the proxy snapshot reaches the menus through the proxy cache, which it
+// rewrites on every refresh
+class Daemon {
+ public:
+  // the out of a failed reply when the daemon can not reach clash, so the
+  // caller may try clash itself
+  static constexpr const char* offline = "offline";
+
+  Daemon(const Config& config, const Controller& controller) noexcept
+      : config_(config), controller_(controller) {}
+
+  // answer requests until a stop request or SIGINT or SIGTERM
+  // returns false if another daemon runs or the socket can not be bound
+  bool serve() noexcept;
+
+  // send a request to the daemon listening on socket_path
+  // nullopt if none answers, so the caller can do the work itself
+  static std::optional<Reply> call(const std::string& socket_path,
+                                   const std::vector<std::string>& request,
+                                   std::chrono::milliseconds timeout =
+                                       std::chrono::seconds(5)) noexcept;
+
+ private:
+  Reply handle(const std::vector<std::string>& request) noexcept;
+
+  // fetch the proxies every config_.daemon_refresh until stopped
+  void refresh_loop() noexcept;
+
+  // read a request, answer it and close the connection
+  void serve_client(const quicky::Socket& client) noexcept;
+
+  // set the proxy or the mode, without holding the lock while clash answers
+  Reply select(const std::string& what, const std::string& name) noexcept;
+
+  static void on_signal(int) noexcept { stopping_ = true; }
+
+ private:
+  const Config& config_;
+  const Controller& controller_;
+  // guards the snapshot of controller_ and online_ between requests and
+  // refreshes
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  // whether the last fetch reached clash
+  bool online_ = false;
+  // a fetch was asked for before the next one is due
+  bool refresh_now_ = false;
+  static inline std::atomic<bool> stopping_{false};
+};
+
+}  // namespace clashctl
+
+/*
+ * Implementation that will be part of the .cpp file if split into .hpp and .cpp
+ * files.
+ */
+
+namespace clashctl {
+
+inline bool Daemon::serve() noexcept {
+  const auto& path = config_.daemon_socket;
+  if (quicky::Socket::connect_unix(path).valid()) {
+    quicky::error() << "a daemon already listens on " << path << std::endl;
+    return false;
+  }
+  // left behind by a daemon that did not exit cleanly
+  unlink(path.c_str());
+  // only the user may talk to it
+  const mode_t mask = umask(0077);
+  auto listener = quicky::Socket::listen_unix(path);
+  umask(mask);
+  if (!listener.valid()) {
+    quicky::error() << "failed to listen on " << path << std::endl;
+    return false;
+  }
+
+  stopping_ = false;
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+  signal(SIGPIPE, SIG_IGN);
+  std::thread refresher(&Daemon::refresh_loop, this);
+  // a restarted clash is fetched from right away
+  Watchdog watchdog(config_, controller_, [this]() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    refresh_now_ = true;
+    cv_.notify_all();
+  });
+  std::thread watcher;
+  if (config_.watchdog_interval > 0) {
+    watcher = std::thread([&]() { watchdog.run(); });
+  }
+  // the daemon is still worth running without them
+  // delay tests go through the members of the snapshot refresh_loop keeps
+  Telemetry telemetry(config_, controller_, [this]() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!online_) return std::vector<std::string>();
+    return controller_.get_proxies().value_or(std::vector<std::string>());
+  });
+  if (!config_.metrics_endpoint.empty()) telemetry.start();
+  quicky::info() << "daemon listening on " << path << std::endl;
+  controller_.events().info("daemon.start", {{"pid", getpid()}});
+
+  httplib::ThreadPool workers(8);
+  while (!stopping_) {
+    // wake up now and then to notice signals
+    pollfd pfd{listener.fd(), POLLIN, 0};
+    if (poll(&pfd, 1, 250) <= 0) continue;
+    auto client = std::make_shared<quicky::Socket>(listener.accept());
+    if (!client->valid()) continue;
+    workers.enqueue([this, client]() { serve_client(*client); });
+  }
+  // the clients accepted so far are still answered
+  workers.shutdown();
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    cv_.notify_all();
+  }
+  refresher.join();
+  watchdog.stop();
+  if (watcher.joinable()) watcher.join();
+  telemetry.stop();
+  unlink(path.c_str());
+  quicky::infoln("daemon stopped.");
+  controller_.events().info("daemon.stop");
+  return true;
+}
+
+inline std::optional<Reply> Daemon::call(
+    const std::string& socket_path, const std::vector<std::string>& request,
+    std::chrono::milliseconds timeout) noexcept {
+  try {
+    auto sock = quicky::Socket::connect_unix(socket_path);
+    if (!sock.valid()) return std::nullopt;
+    if (!sock.send_all(nlohmann::json(request).dump() + "\n", timeout)) {
+      return std::nullopt;
+    }
+    std::string line;
+    char buf[4096];
+    while (line.empty() || line.back() != '\n') {
+      const auto n = sock.recv_some(buf, sizeof(buf), timeout);
+      if (n <= 0) return std::nullopt;
+      line.append(buf, n);
+    }
+    const auto j = nlohmann::json::parse(line);
+    return Reply{j.at("ok").get<bool>(), j.at("out").get<std::string>()};
+  } catch (const std::exception& e) {
+    return std::nullopt;
+  }
+}
+
+inline void Daemon::serve_client(const quicky::Socket& client) noexcept {
+  // a client that does not send its request in time is dropped, so it can
+  // not hold up the others
+  constexpr auto timeout = std::chrono::seconds(1);
+  std::string line;
+  char buf[4096];
+  while (line.empty() || line.back() != '\n') {
+    const auto n = client.recv_some(buf, sizeof(buf), timeout);
+    if (n <= 0 || line.size() > 65536) return;
+    line.append(buf, n);
+  }
+  Reply reply;
+  try {
+    reply = handle(nlohmann::json::parse(line).get<std::vector<std::string>>());
+  } catch (const std::exception& e) {
+    reply = {false, "invalid request."};
+  }
+  client.send_all(
+      nlohmann::json{{"ok", reply.ok}, {"out", reply.out}}.dump() + "\n",
+      timeout);
+}
+
+inline Reply Daemon::handle(const std::vector<std::string>& request) noexcept {
+  if (request.empty()) return {false, "empty request."};
+  const auto& cmd = request[0];
+  if ((cmd == "proxy" || cmd == "mode") && request.size() == 2) {
+    return select(cmd, request[1]);
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (cmd == "status") {
+    // a stale snapshot would claim a proxy clash no longer uses
+    if (!online_) return {false, offline};
+    return {true, controller_.status()};
+  }
+  if (cmd == "refresh") {
+    refresh_now_ = true;
+    cv_.notify_all();
+    return {true, ""};
+  }
+  if (cmd == "stop") {
+    stopping_ = true;
+    cv_.notify_all();
+    return {true, "daemon stopping."};
+  }
+  return {false, "unknown request " + cmd + "."};
+}
+
+inline Reply Daemon::select(const std::string& what,
+                            const std::string& name) noexcept {
+  std::string group;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!online_) return {false, offline};
+    group = controller_.selector(what == "mode");
+  }
+  if (group.empty()) return {false, "no group to set " + what + " with."};
+  if (!controller_.put_selection(group, name, what.c_str())) {
+    return {false, "failed to set " + what + " to " + name + "."};
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  controller_.record_selection(group, name);
+  return {true, "current " + what + ": " + name};
+}
+
+inline void Daemon::refresh_loop() noexcept {
+  const auto interval = std::chrono::milliseconds(config_.daemon_refresh);
+  while (!stopping_) {
+    // the daemon is the parent of a clash the watchdog restarted, and of its
+    // log sink
+    controller_.reap();
+    // fetched without the lock, requests keep being answered meanwhile
+    auto model = controller_.fetch_proxies();
+    std::unique_lock<std::mutex> lock(mutex_);
+    online_ = model.has_value();
+    if (online_) controller_.use_proxies(std::move(*model));
+    cv_.wait_for(lock, interval, [&]() { return stopping_ || refresh_now_; });
+    refresh_now_ = false;
+  }
+}
+
+}  // namespace clashctl
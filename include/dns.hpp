@@ -0,0 +1,151 @@
+#pragma once
+
+/*
+ * Headers
+ */
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+/*
+ * Declaration
+ */
+
+namespace quicky {
+
+// resolves host names to addresses, remembering them in a file for ttl so
+// that repeated runs need no lookups
+// safe to use from several threads
+class DnsCache {
+ public:
+  DnsCache(const std::string& filepath, std::chrono::seconds ttl) noexcept;
+
+  // the first address of host, nullopt if it can not be resolved
+  std::optional<std::string> resolve(const std::string& host) noexcept;
+
+  // write the entries that have not expired back to the file
+  bool save() const noexcept;
+
+ private:
+  struct Entry {
+    std::string ip;
+    std::time_t expires;
+  };
+
+  static bool is_ip(const std::string& host) noexcept;
+
+ private:
+  const std::string filepath_;
+  const std::chrono::seconds ttl_;
+  mutable std::mutex mutex_;
+  std::unordered_map<std::string, Entry> entries_;
+};
+
+}  // namespace quicky
+
+/*
+ * Implementation that will be part of the .cpp file if split into .hpp and .cpp
+ * files.
+ */
+
+namespace quicky {
+
+inline DnsCache::DnsCache(const std::string& filepath,
+                          std::chrono::seconds ttl) noexcept
+    : filepath_(filepath), ttl_(ttl) {
+  std::ifstream f(filepath_);
+  const auto now = std::time(nullptr);
+  std::string host, ip;
+  std::time_t expires;
+  while (f >> host >> ip >> expires) {
+    if (expires > now) entries_[host] = {ip, expires};
+  }
+}
+
+inline std::optional<std::string> DnsCache::resolve(
+    const std::string& host) noexcept {
+  if (is_ip(host)) return host;
+  const auto now = std::time(nullptr);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(host);
+    if (it != entries_.end() && it->second.expires > now) return it->second.ip;
+  }
+
+  // resolve without holding the lock, so lookups run concurrently
+  addrinfo hints{};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* res = nullptr;
+  if (getaddrinfo(host.c_str(), nullptr, &hints, &res) != 0 || !res) {
+    return std::nullopt;
+  }
+  char buf[INET6_ADDRSTRLEN] = "";
+  if (res->ai_family == AF_INET) {
+    inet_ntop(AF_INET, &reinterpret_cast<sockaddr_in*>(res->ai_addr)->sin_addr,
+              buf, sizeof(buf));
+  } else if (res->ai_family == AF_INET6) {
+    inet_ntop(AF_INET6,
+              &reinterpret_cast<sockaddr_in6*>(res->ai_addr)->sin6_addr, buf,
+              sizeof(buf));
+  }
+  freeaddrinfo(res);
+  if (!*buf) return std::nullopt;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  entries_[host] = {buf, now + ttl_.count()};
+  return std::string(buf);
+}
+
+inline bool DnsCache::save() const noexcept {
+  const auto now = std::time(nullptr);
+  std::string buf;
+  try {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto&& [host, entry] : entries_) {
+      if (entry.expires > now) {
+        buf.append(host).append(" ").append(entry.ip).append(" ");
+        buf.append(std::to_string(entry.expires)).append("\n");
+      }
+    }
+  } catch (const std::exception& e) {
+    return false;
+  }
+
+  // other processes save the same cache, each through a file of its own
+  std::string tmp = filepath_ + ".XXXXXX";
+  const int fd = mkstemp(tmp.data());
+  if (fd < 0) return false;
+  bool ok = true;
+  for (size_t at = 0; ok && at < buf.size();) {
+    const ssize_t n = ::write(fd, buf.data() + at, buf.size() - at);
+    if (n < 0 && errno == EINTR) continue;
+    ok = n > 0;
+    if (ok) at += n;
+  }
+  ok = ::close(fd) == 0 && ok;
+  if (ok && std::rename(tmp.c_str(), filepath_.c_str()) == 0) return true;
+  unlink(tmp.c_str());
+  return false;
+}
+
+inline bool DnsCache::is_ip(const std::string& host) noexcept {
+  unsigned char buf[16];
+  return inet_pton(AF_INET, host.c_str(), buf) == 1 ||
+         inet_pton(AF_INET6, host.c_str(), buf) == 1;
+}
+
+}  // namespace quicky
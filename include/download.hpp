@@ -0,0 +1,143 @@
+#pragma once
+
+/*
+ * Headers
+ */
+
+#include <cstdio>
+#include <optional>
+#include <string>
+#include <utility>
+
+#include "sha256.hpp"
+#include "third-party/yhirose/httplib.h"
+#include "utils.hpp"
+
+/*
+ * Declaration
+ */
+
+namespace quicky {
+
+// validators of a previously downloaded resource for a conditional get
+struct Validators {
+  std::string etag;
+  std::string last_modified;
+};
+
+struct Download {
+  // 200 if the body was downloaded, 304 if it was not modified
+  int status = 0;
+  // validators to send on the next download of the same url
+  Validators validators;
+  // hex sha-256 of the downloaded body, empty on 304
+  std::string sha256;
+};
+
+// split an url into "scheme://host:port" and "/path?query"
+std::pair<std::string, std::string> split_url(const std::string& url) noexcept;
+
+// stream url into filepath without buffering the body in memory
+// the request is conditional on cached and asks for a gzip encoded body
+// returns nullopt on failure
+std::optional<Download> download(const std::string& url,
+                                 const std::string& filepath,
+                                 const Validators& cached) noexcept;
+
+}  // namespace quicky
+
+/*
+ * Implementation that will be part of the .cpp file if split into .hpp and .cpp
+ * files.
+ */
+
+namespace quicky {
+
+inline std::pair<std::string, std::string> split_url(
+    const std::string& url) noexcept {
+  const auto scheme_end = url.find("://");
+  const auto host_begin = scheme_end == std::string::npos ? 0 : scheme_end + 3;
+  const auto path_begin = url.find_first_of("/?", host_begin);
+  if (path_begin == std::string::npos) return {url, "/"};
+  auto path = url.substr(path_begin);
+  if (path.front() == '?') path.insert(path.begin(), '/');
+  return {url.substr(0, path_begin), path};
+}
+
+inline std::optional<Download> download(const std::string& url,
+                                        const std::string& filepath,
+                                        const Validators& cached) noexcept {
+  constexpr int max_redirects = 10;
+  std::string target = url;
+
+  for (int i = 0; i <= max_redirects; ++i) {
+    const auto [base, path] = split_url(target);
+    httplib::Client cli(base);
+    if (!cli.is_valid()) {
+      error() << "unsupported url: " << target << std::endl;
+      return std::nullopt;
+    }
+    // redirects are followed here, httplib would treat 304 as one
+    cli.set_follow_location(false);
+    cli.set_connection_timeout(std::chrono::seconds(10));
+    cli.set_read_timeout(std::chrono::seconds(30));
+
+    httplib::Headers headers;
+#ifdef CPPHTTPLIB_ZLIB_SUPPORT
+    headers.emplace("Accept-Encoding", "gzip");
+#endif
+    if (!cached.etag.empty()) headers.emplace("If-None-Match", cached.etag);
+    if (!cached.last_modified.empty()) {
+      headers.emplace("If-Modified-Since", cached.last_modified);
+    }
+
+    Download result;
+    Sha256 sha;
+    std::FILE* out = nullptr;
+    auto res = cli.Get(
+        path, headers,
+        [&](const httplib::Response& r) {
+          if (r.status != 200) return true;
+          out = std::fopen(filepath.c_str(), "wb");
+          return out != nullptr;
+        },
+        [&](const char* data, size_t size) {
+          if (!out) return true;
+          sha.update(data, size);
+          return std::fwrite(data, 1, size, out) == size;
+        });
+    const bool written = out && std::fclose(out) == 0;
+
+    if (!res) {
+      error() << "failed to download: " << httplib::to_string(res.error())
+              << std::endl;
+      return std::nullopt;
+    }
+    if (res->status >= 300 && res->status < 400 && res->status != 304) {
+      auto location = res->get_header_value("Location");
+      if (location.empty()) return std::nullopt;
+      target = location.front() == '/' ? base + location : location;
+      continue;
+    }
+    if (res->status == 304) {
+      result.status = 304;
+      result.validators = cached;
+      return result;
+    }
+    if (res->status != 200 || !written) {
+      error() << "failed to download: http status " << res->status
+              << std::endl;
+      return std::nullopt;
+    }
+
+    result.status = 200;
+    result.validators.etag = res->get_header_value("ETag");
+    result.validators.last_modified = res->get_header_value("Last-Modified");
+    result.sha256 = sha.hex();
+    return result;
+  }
+  errorln("failed to download: too many redirects.");
+  return std::nullopt;
+}
+
+}  // namespace quicky
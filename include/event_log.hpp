@@ -0,0 +1,150 @@
+#pragma once
+
+/*
+ * Headers
+ */
+
+#include <chrono>
+#include <condition_variable>
+#include <ctime>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "rotating_file.hpp"
+#include "third-party/nlohmann/json.hpp"
+
+/*
+ * Declaration
+ */
+
+namespace quicky {
+
+// an asynchronous log of events as json lines, like
+//   {"time":"2023-01-01T08:00:00.123+0800","level":"info","event":"...",...}
+// events are formatted into a buffer and written to a rotating file by a
+// thread of their own about once a second, so logging never waits for the
+// disk
+// the thread is only started by the first event, and everything logged is
+// written before the destructor returns
+// thread-safe
+class EventLog {
+ public:
+  EventLog(const std::string& path, size_t max_size, size_t generations,
+           bool compress) noexcept
+      : file_(path, max_size, generations, compress) {}
+
+  EventLog(const EventLog&) = delete;
+
+  EventLog& operator=(const EventLog&) = delete;
+
+  ~EventLog();
+
+  // log an event with fields, an object merged into the line
+  void write(const char* level, const char* event,
+             nlohmann::json&& fields = nlohmann::json::object()) noexcept;
+
+  void info(const char* event,
+            nlohmann::json&& fields = nlohmann::json::object()) noexcept {
+    write("info", event, std::move(fields));
+  }
+
+  void error(const char* event,
+             nlohmann::json&& fields = nlohmann::json::object()) noexcept {
+    write("error", event, std::move(fields));
+  }
+
+ private:
+  void flush_loop() noexcept;
+
+ private:
+  // buffered events above this are written without waiting for the second
+  static constexpr size_t flush_size = 64 * 1024;
+
+  RotatingFile file_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  // formatted lines, swapped with the buffer being written
+  std::string pending_;
+  std::thread flusher_;
+  bool closed_ = false;
+};
+
+}  // namespace quicky
+
+/*
+ * Implementation that will be part of the .cpp file if split into .hpp and .cpp
+ * files.
+ */
+
+namespace quicky {
+
+inline EventLog::~EventLog() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+    cv_.notify_all();
+  }
+  if (flusher_.joinable()) flusher_.join();
+}
+
+inline void EventLog::write(const char* level, const char* event,
+                            nlohmann::json&& fields) noexcept {
+  try {
+    using namespace std::chrono;
+    const auto now = system_clock::now();
+    const std::time_t t = system_clock::to_time_t(now);
+    const auto ms =
+        duration_cast<milliseconds>(now.time_since_epoch()).count() % 1000;
+    std::tm tm;
+    localtime_r(&t, &tm);
+    char date[32], zone[8];
+    std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", &tm);
+    std::strftime(zone, sizeof(zone), "%z", &tm);
+    char time[48];
+    std::snprintf(time, sizeof(time), "%s.%03d%s", date, static_cast<int>(ms),
+                  zone);
+
+    // by hand, so the common keys come first rather than sorted
+    auto dump = [](const nlohmann::json& j) {
+      return j.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace);
+    };
+    std::string text = "{\"time\":" + dump(time) + ",\"level\":" +
+                       dump(level) + ",\"event\":" + dump(event);
+    if (fields.is_object() && !fields.empty()) {
+      text += ',';
+      text += dump(fields).substr(1);
+    } else {
+      text += '}';
+    }
+    text += '\n';
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (closed_) return;
+    if (!flusher_.joinable()) {
+      flusher_ = std::thread(&EventLog::flush_loop, this);
+    }
+    pending_ += text;
+    if (pending_.size() >= flush_size) cv_.notify_all();
+  } catch (const std::exception& e) {
+  }
+}
+
+inline void EventLog::flush_loop() noexcept {
+  std::string writing;
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    cv_.wait_for(lock, std::chrono::seconds(1), [&]() {
+      return closed_ || pending_.size() >= flush_size;
+    });
+    writing.swap(pending_);
+    const bool closed = closed_;
+    lock.unlock();
+    if (!writing.empty()) file_.write(writing);
+    writing.clear();
+    if (closed) return;
+    lock.lock();
+  }
+}
+
+}  // namespace quicky
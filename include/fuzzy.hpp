@@ -0,0 +1,158 @@
+#pragma once
+
+/*
+ * Headers
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*
+ * Declaration
+ */
+
+namespace quicky {
+
+// ranks items against a fuzzy query, for type-to-filter menus
+// items are lowercased once, and each gets a 64-bit mask of the characters it
+// contains, so most non-matching items are rejected with a single bitwise and
+// the matches of every prefix of the query are kept, so typing a character
+// only rescans the previous matches and backspace costs nothing
+class FuzzyIndex {
+ public:
+  explicit FuzzyIndex(const std::vector<std::string>& items);
+
+  // indices of the items matching query, best first
+  std::vector<int> filter(const std::string& query);
+
+  // score of item i against a lowercase query, nullopt if it does not match
+  std::optional<int> score(int i, std::string_view query) const noexcept;
+
+ private:
+  static uint64_t mask(std::string_view str) noexcept;
+
+  static char lower(char c) noexcept {
+    return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+  }
+
+ private:
+  std::vector<std::string> lower_;
+  std::vector<uint64_t> masks_;
+  // the query the matches were computed for
+  std::string query_;
+  // matches_[k] holds the items matching the first k characters of query_
+  std::vector<std::vector<int>> matches_;
+};
+
+}  // namespace quicky
+
+/*
+ * Implementation that will be part of the .cpp file if split into .hpp and .cpp
+ * files.
+ */
+
+namespace quicky {
+
+inline FuzzyIndex::FuzzyIndex(const std::vector<std::string>& items) {
+  lower_.reserve(items.size());
+  masks_.reserve(items.size());
+  for (auto&& item : items) {
+    std::string l(item.size(), '\0');
+    std::transform(item.begin(), item.end(), l.begin(), lower);
+    masks_.push_back(mask(l));
+    lower_.push_back(std::move(l));
+  }
+  std::vector<int> all(items.size());
+  for (size_t i = 0; i < all.size(); ++i) all[i] = i;
+  matches_.push_back(std::move(all));
+}
+
+inline std::vector<int> FuzzyIndex::filter(const std::string& query) {
+  std::string q(query.size(), '\0');
+  std::transform(query.begin(), query.end(), q.begin(), lower);
+
+  // reuse the matches of the common prefix with the last query
+  size_t common = 0;
+  while (common < q.size() && common < query_.size() &&
+         q[common] == query_[common]) {
+    ++common;
+  }
+  matches_.resize(common + 1);
+  query_ = q;
+
+  for (size_t k = common + 1; k <= q.size(); ++k) {
+    const std::string_view prefix(q.data(), k);
+    const uint64_t m = mask(prefix);
+    std::vector<int> next;
+    for (int i : matches_[k - 1]) {
+      if ((masks_[i] & m) != m) continue;
+      if (score(i, prefix)) next.push_back(i);
+    }
+    matches_.push_back(std::move(next));
+  }
+
+  std::vector<std::pair<int, int>> ranked;
+  ranked.reserve(matches_.back().size());
+  for (int i : matches_.back()) ranked.emplace_back(-*score(i, q), i);
+  std::sort(ranked.begin(), ranked.end());
+  std::vector<int> res;
+  res.reserve(ranked.size());
+  for (auto&& r : ranked) res.push_back(r.second);
+  return res;
+}
+
+inline std::optional<int> FuzzyIndex::score(
+    int i, std::string_view query) const noexcept {
+  const std::string_view item = lower_[i];
+  if (query.empty()) return 0;
+
+  // a plain substring beats any scattered match
+  const auto pos = item.find(query);
+  if (pos != std::string_view::npos) {
+    int s = 1000 + 10 * static_cast<int>(query.size());
+    if (pos == 0 || !std::isalnum(static_cast<unsigned char>(item[pos - 1]))) {
+      s += 100;
+    }
+    return s - static_cast<int>(item.size());
+  }
+
+  // otherwise the query has to appear in order, starting from the first
+  // occurrence of its first character
+  const void* first = std::memchr(item.data(), query[0], item.size());
+  if (!first) return std::nullopt;
+  size_t j = static_cast<const char*>(first) - item.data();
+  int s = 0;
+  size_t last = j;
+  for (size_t k = 0; k < query.size(); ++k, ++j) {
+    while (j < item.size() && item[j] != query[k]) ++j;
+    if (j >= item.size()) return std::nullopt;
+    if (k > 0 && j == last + 1) s += 10;
+    if (j == 0 || !std::isalnum(static_cast<unsigned char>(item[j - 1]))) {
+      s += 5;
+    }
+    last = j;
+  }
+  return s - static_cast<int>(item.size());
+}
+
+inline uint64_t FuzzyIndex::mask(std::string_view str) noexcept {
+  uint64_t m = 0;
+  for (unsigned char c : str) {
+    if (c >= 'a' && c <= 'z') {
+      m |= uint64_t(1) << (c - 'a');
+    } else if (c >= '0' && c <= '9') {
+      m |= uint64_t(1) << (26 + c - '0');
+    } else {
+      m |= uint64_t(1) << (36 + c % 28);
+    }
+  }
+  return m;
+}
+
+}  // namespace quicky
@@ -0,0 +1,196 @@
+#pragma once
+
+/*
+ * Headers
+ */
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "sha256.hpp"
+
+/*
+ * Declaration
+ */
+
+namespace clashctl {
+
+// config files stored once by content hash, with the config file being a
+// symlink to one of them
+// switching generations renames a symlink over the config file, so it is
+// atomic and never copies any config
+class Generations {
+ public:
+  Generations(const std::string& dir, const std::string& link,
+              size_t max_history) noexcept
+      : dir_(dir), link_(link), max_history_(max_history) {}
+
+  // move filepath into the store, returns its hash
+  // sha256 may be given if it is already known
+  std::optional<std::string> store(const std::string& filepath,
+                                   std::string sha256 = "") const noexcept;
+
+  // atomically point the config file at a stored generation
+  bool activate(const std::string& hash) const noexcept;
+
+  // record a generation as applied, dropping the oldest ones beyond
+  // max_history from the store
+  bool record(const std::string& hash) const noexcept;
+
+  // drop a stored generation that was never recorded, such as a config that
+  // failed to apply, unless it is recorded or active
+  void discard(const std::string& hash) const noexcept;
+
+  // hash of the active generation, empty if there is none
+  std::string current() const noexcept;
+
+  // applied generations, the most recent first
+  std::vector<std::string> history() const noexcept;
+
+  // path of a stored generation
+  std::string path(const std::string& hash) const noexcept {
+    return dir_ + "/" + hash + ".yaml";
+  }
+
+  // turn a plain config file left by older versions into a generation
+  bool import_config() const noexcept;
+
+ private:
+  bool write_history(const std::vector<std::string>& hashes) const noexcept;
+
+  std::string history_file() const noexcept { return dir_ + "/history"; }
+
+ private:
+  const std::string dir_;
+  const std::string link_;
+  const size_t max_history_;
+};
+
+}  // namespace clashctl
+
+/*
+ * Implementation that will be part of the .cpp file if split into .hpp and .cpp
+ * files.
+ */
+
+namespace clashctl {
+
+inline std::optional<std::string> Generations::store(
+    const std::string& filepath, std::string sha256) const noexcept {
+  if (sha256.empty()) {
+    auto hash = quicky::sha256_file(filepath);
+    if (!hash.has_value()) return std::nullopt;
+    sha256 = std::move(hash.value());
+  }
+  std::error_code ec;
+  std::filesystem::create_directories(dir_, ec);
+  const auto dest = path(sha256);
+  if (std::filesystem::exists(dest, ec)) {
+    std::filesystem::remove(filepath, ec);
+    return sha256;
+  }
+  if (::rename(filepath.c_str(), dest.c_str()) != 0) {
+    // another filesystem, copy then rename so the store never holds a
+    // partial file
+    const auto tmp = dest + ".tmp";
+    if (!std::filesystem::copy_file(
+            filepath, tmp, std::filesystem::copy_options::overwrite_existing,
+            ec) ||
+        ::rename(tmp.c_str(), dest.c_str()) != 0) {
+      return std::nullopt;
+    }
+    std::filesystem::remove(filepath, ec);
+  }
+  return sha256;
+}
+
+inline bool Generations::activate(const std::string& hash) const noexcept {
+  std::error_code ec;
+  if (!std::filesystem::exists(path(hash), ec)) return false;
+  const auto tmp = link_ + ".tmp";
+  std::filesystem::remove(tmp, ec);
+  // relative, so the clashctl folder can be moved
+  const auto target = std::filesystem::relative(
+      path(hash), std::filesystem::path(link_).parent_path(), ec);
+  if (ec) return false;
+  std::filesystem::create_symlink(target, tmp, ec);
+  if (ec) return false;
+  return ::rename(tmp.c_str(), link_.c_str()) == 0;
+}
+
+inline bool Generations::record(const std::string& hash) const noexcept {
+  auto hashes = history();
+  hashes.erase(std::remove(hashes.begin(), hashes.end(), hash), hashes.end());
+  hashes.insert(hashes.begin(), hash);
+
+  std::error_code ec;
+  while (hashes.size() > max_history_) {
+    std::filesystem::remove(path(hashes.back()), ec);
+    hashes.pop_back();
+  }
+  return write_history(hashes);
+}
+
+inline void Generations::discard(const std::string& hash) const noexcept {
+  const auto hashes = history();
+  if (hash == current() ||
+      std::find(hashes.begin(), hashes.end(), hash) != hashes.end()) {
+    return;
+  }
+  std::error_code ec;
+  std::filesystem::remove(path(hash), ec);
+}
+
+inline std::string Generations::current() const noexcept {
+  std::error_code ec;
+  const auto target = std::filesystem::read_symlink(link_, ec);
+  if (ec) return "";
+  return target.stem().string();
+}
+
+inline std::vector<std::string> Generations::history() const noexcept {
+  std::vector<std::string> hashes;
+  std::ifstream f(history_file());
+  std::string line;
+  while (std::getline(f, line)) {
+    if (!line.empty()) hashes.push_back(line);
+  }
+  return hashes;
+}
+
+inline bool Generations::import_config() const noexcept {
+  std::error_code ec;
+  if (std::filesystem::is_symlink(link_, ec) ||
+      !std::filesystem::is_regular_file(link_, ec)) {
+    return true;
+  }
+  // keep the config file in place until the symlink replaces it
+  const auto tmp = dir_ + "/import.tmp";
+  std::filesystem::create_directories(dir_, ec);
+  if (!std::filesystem::copy_file(
+          link_, tmp, std::filesystem::copy_options::overwrite_existing, ec)) {
+    return false;
+  }
+  auto hash = store(tmp);
+  return hash.has_value() && activate(*hash) && record(*hash);
+}
+
+inline bool Generations::write_history(
+    const std::vector<std::string>& hashes) const noexcept {
+  const auto tmp = history_file() + ".tmp";
+  {
+    std::ofstream f(tmp, std::ios::trunc);
+    for (auto&& h : hashes) f << h << '\n';
+    if (!f) return false;
+  }
+  return ::rename(tmp.c_str(), history_file().c_str()) == 0;
+}
+
+}  // namespace clashctl
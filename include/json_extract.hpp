@@ -0,0 +1,293 @@
+#pragma once
+
+/*
+ * Headers
+ */
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "third-party/nlohmann/json.hpp"
+
+/*
+ * Declaration
+ */
+
+namespace quicky {
+
+// a stream buffer fed with chunks by one thread and read by another, so a
+// response body can be parsed while it is still being received
+// chunks are copied into strings that are recycled once read
+class ChunkStreamBuf : public std::streambuf {
+ public:
+  // the producer waits while more than max_buffered bytes are unread
+  explicit ChunkStreamBuf(size_t max_buffered = 1 << 20) noexcept
+      : max_buffered_(max_buffered) {}
+
+  // queue a chunk, returns false once the reader is done and wants no more
+  bool push(const char* data, size_t size);
+
+  // no more chunks will come, the reader sees the end of the stream
+  void close();
+
+  // called by the reader when it stops reading, so the producer stops too
+  void done();
+
+ protected:
+  int_type underflow() override;
+
+ private:
+  const size_t max_buffered_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<std::string> chunks_;
+  // the chunk being read
+  std::string current_;
+  // read chunks kept for their memory
+  std::vector<std::string> spare_;
+  size_t buffered_ = 0;
+  bool closed_ = false;
+  bool done_ = false;
+};
+
+// materializes only the values at some paths of a json document through the
+// sax interface of nlohmann json, everything else is skipped as it is parsed
+// a path is a list of object keys, where "*" also matches any key and any
+// array element
+// use with nlohmann::json::sax_parse
+class JsonExtractor {
+ public:
+  using Path = std::vector<std::string>;
+
+  // fn is called with the keys leading to every matching value, where array
+  // elements are empty, and the value itself
+  using Callback =
+      std::function<void(const std::vector<std::string>&, nlohmann::json&&)>;
+
+  // filter is asked with the keys of every matching value before it is
+  // materialized, and skips it by returning false, so what is wanted may
+  // depend on what came before
+  using Filter = std::function<bool(const std::vector<std::string>&)>;
+
+  JsonExtractor(std::vector<Path>&& paths, Callback&& fn,
+                Filter&& filter = nullptr) noexcept
+      : paths_(std::move(paths)),
+        fn_(std::move(fn)),
+        filter_(std::move(filter)) {}
+
+  // the sax interface
+  bool null() { return value(nullptr); }
+
+  bool boolean(bool v) { return value(v); }
+
+  bool number_integer(nlohmann::json::number_integer_t v) { return value(v); }
+
+  bool number_unsigned(nlohmann::json::number_unsigned_t v) {
+    return value(v);
+  }
+
+  bool number_float(nlohmann::json::number_float_t v, const std::string&) {
+    return value(v);
+  }
+
+  bool string(std::string& v) { return value(std::move(v)); }
+
+  bool start_object(size_t) { return start(false); }
+
+  bool key(std::string& k);
+
+  bool end_object() { return end(); }
+
+  bool start_array(size_t) { return start(true); }
+
+  bool end_array() { return end(); }
+
+  bool parse_error(size_t, const std::string&,
+                   const nlohmann::detail::exception& e) {
+    error_ = e.what();
+    return false;
+  }
+
+  // why parsing stopped, empty if it did not fail
+  const std::string& error() const noexcept { return error_; }
+
+ private:
+  // whether the value at the current position was asked for
+  bool matches() const noexcept;
+
+  // whether it was asked for and not filtered out
+  bool wanted() const;
+
+  // values that are not asked for are never turned into json
+  template <class T>
+  bool value(T&& v);
+
+  // containers are only created if they are asked for or inside one that is
+  bool start(bool array);
+
+  bool end();
+
+  // add a value to the container being materialized
+  nlohmann::json& add(nlohmann::json&& v);
+
+ private:
+  const std::vector<Path> paths_;
+  Callback fn_;
+  Filter filter_;
+  // the keys leading to the current position, empty for array elements
+  std::vector<std::string> keys_;
+  // whether each container around the current position is an array
+  std::vector<bool> arrays_;
+  // the value being materialized and the containers open inside it
+  nlohmann::json captured_;
+  std::vector<nlohmann::json*> capture_;
+  // the key of the next value inside captured_
+  std::string capture_key_;
+  std::string error_;
+};
+
+}  // namespace quicky
+
+/*
+ * Implementation of template methods.
+ */
+
+namespace quicky {
+
+template <class T>
+bool JsonExtractor::value(T&& v) {
+  if (!capture_.empty()) {
+    add(nlohmann::json(std::forward<T>(v)));
+  } else if (wanted()) {
+    fn_(keys_, nlohmann::json(std::forward<T>(v)));
+  }
+  return true;
+}
+
+}  // namespace quicky
+
+/*
+ * Implementation that will be part of the .cpp file if split into .hpp and .cpp
+ * files.
+ */
+
+namespace quicky {
+
+inline bool ChunkStreamBuf::push(const char* data, size_t size) {
+  if (size == 0) return true;
+  std::unique_lock<std::mutex> lock(mutex_);
+  cv_.wait(lock, [&]() { return done_ || buffered_ < max_buffered_; });
+  if (done_) return false;
+  std::string chunk;
+  if (!spare_.empty()) {
+    chunk = std::move(spare_.back());
+    spare_.pop_back();
+  }
+  chunk.assign(data, size);
+  buffered_ += size;
+  chunks_.push_back(std::move(chunk));
+  cv_.notify_all();
+  return true;
+}
+
+inline void ChunkStreamBuf::close() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  closed_ = true;
+  cv_.notify_all();
+}
+
+inline void ChunkStreamBuf::done() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  done_ = true;
+  cv_.notify_all();
+}
+
+inline ChunkStreamBuf::int_type ChunkStreamBuf::underflow() {
+  if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (!current_.empty()) {
+    buffered_ -= current_.size();
+    current_.clear();
+    spare_.push_back(std::move(current_));
+    cv_.notify_all();
+  }
+  cv_.wait(lock, [&]() { return closed_ || !chunks_.empty(); });
+  if (chunks_.empty()) return traits_type::eof();
+  current_ = std::move(chunks_.front());
+  chunks_.pop_front();
+  char* begin = current_.data();
+  setg(begin, begin, begin + current_.size());
+  return traits_type::to_int_type(*gptr());
+}
+
+inline bool JsonExtractor::key(std::string& k) {
+  // copied rather than moved, so both the key and the buffer of the parser
+  // keep their memory
+  if (!capture_.empty()) {
+    capture_key_.assign(k);
+  } else {
+    keys_.back().assign(k);
+  }
+  return true;
+}
+
+inline bool JsonExtractor::matches() const noexcept {
+  for (auto&& path : paths_) {
+    if (path.size() != keys_.size()) continue;
+    bool match = true;
+    for (size_t i = 0; i < path.size() && match; ++i) {
+      match = path[i] == "*" || (!arrays_[i] && path[i] == keys_[i]);
+    }
+    if (match) return true;
+  }
+  return false;
+}
+
+inline bool JsonExtractor::wanted() const {
+  return matches() && (!filter_ || filter_(keys_));
+}
+
+inline bool JsonExtractor::start(bool array) {
+  auto container = array ? nlohmann::json::value_t::array
+                         : nlohmann::json::value_t::object;
+  if (!capture_.empty()) {
+    capture_.push_back(&add(container));
+  } else if (wanted()) {
+    captured_ = container;
+    capture_.push_back(&captured_);
+  } else {
+    arrays_.push_back(array);
+    keys_.emplace_back();
+  }
+  return true;
+}
+
+inline bool JsonExtractor::end() {
+  if (!capture_.empty()) {
+    capture_.pop_back();
+    if (capture_.empty()) fn_(keys_, std::move(captured_));
+  } else {
+    arrays_.pop_back();
+    keys_.pop_back();
+  }
+  return true;
+}
+
+inline nlohmann::json& JsonExtractor::add(nlohmann::json&& v) {
+  auto& container = *capture_.back();
+  if (container.is_array()) {
+    container.push_back(std::move(v));
+    return container.back();
+  }
+  auto& slot = container[capture_key_];
+  slot = std::move(v);
+  return slot;
+}
+
+}  // namespace quicky
@@ -0,0 +1,125 @@
+#pragma once
+
+/*
+ * Headers
+ */
+
+#include <algorithm>
+#include <condition_variable>
+#include <ctime>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "ndjson.hpp"
+#include "ring_buffer.hpp"
+
+/*
+ * Declaration
+ */
+
+namespace clashctl {
+
+// a line of the clash /logs stream
+struct LogEntry {
+  // when it was received, clash does not send one
+  std::time_t time = 0;
+  std::string type;
+  std::string payload;
+};
+
+// hands log entries from the stream to the printer
+// the stream never waits for the printer, entries go into a fixed-size ring
+// buffer and the oldest are dropped when the printer falls behind a burst
+// entries are swapped in and the printer swaps the whole buffer out, so the
+// lock is only held for a few pointer swaps, and the strings already
+// allocated keep being reused for later entries
+class LogBuffer {
+ public:
+  explicit LogBuffer(size_t capacity)
+      : pending_(capacity), draining_(capacity) {}
+
+  static const std::vector<std::string>& levels() noexcept;
+
+  // parse a line of the stream into the buffer, returns false if it is not a
+  // log entry
+  // called by a single stream
+  bool push(std::string_view line);
+
+  // wait for entries and call fn for each, oldest first
+  // dropped is set to how many were dropped since the last call
+  // returns false once the buffer is closed and empty
+  bool drain(const std::function<void(const LogEntry&)>& fn, size_t& dropped);
+
+  // wake the printer up for the last time
+  void close();
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  // the entry being parsed, only used by the stream
+  LogEntry parsed_;
+  quicky::RingBuffer<LogEntry> pending_;
+  quicky::RingBuffer<LogEntry> draining_;
+  size_t dropped_ = 0;
+  bool closed_ = false;
+};
+
+}  // namespace clashctl
+
+/*
+ * Implementation that will be part of the .cpp file if split into .hpp and .cpp
+ * files.
+ */
+
+namespace clashctl {
+
+inline const std::vector<std::string>& LogBuffer::levels() noexcept {
+  static std::vector<std::string> levels_ = {"debug", "info", "warning",
+                                             "error"};
+  return levels_;
+}
+
+inline bool LogBuffer::push(std::string_view line) {
+  if (!quicky::json_string(line, "type", parsed_.type) ||
+      !quicky::json_string(line, "payload", parsed_.payload)) {
+    return false;
+  }
+  parsed_.time = std::time(nullptr);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    bool dropped;
+    // swap rather than copy, the replaced strings are reused by the next line
+    std::swap(pending_.push_slot(dropped), parsed_);
+    if (dropped) ++dropped_;
+  }
+  cv_.notify_one();
+  return true;
+}
+
+inline bool LogBuffer::drain(const std::function<void(const LogEntry&)>& fn,
+                             size_t& dropped) {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [&]() { return closed_ || !pending_.empty(); });
+    if (pending_.empty()) return false;
+    std::swap(pending_, draining_);
+    dropped = dropped_;
+    dropped_ = 0;
+  }
+  for (size_t i = 0; i < draining_.size(); ++i) fn(draining_[i]);
+  draining_.clear();
+  return true;
+}
+
+inline void LogBuffer::close() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+  }
+  cv_.notify_one();
+}
+
+}  // namespace clashctl
@@ -4,15 +4,23 @@
  * Headers
  */
 
+#include <fcntl.h>
+#include <poll.h>
 #include <termios.h>
 #include <unistd.h>
 
+#include <cerrno>
 #include <cstdio>
 #include <cstdlib>
 #include <functional>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
 #include <vector>
 
+#include "fuzzy.hpp"
+
 /*
  * Declaration
  */
@@ -34,10 +42,41 @@ class RawMode {
       ;
 };
 
+// draws frames of lines on the terminal, rewriting only the rows that
+// changed since the last frame with ansi cursor movement
+// each frame goes out in a single write
+class Renderer {
+ public:
+  explicit Renderer(int fd = STDOUT_FILENO) noexcept : fd_(fd) {}
+
+  void render(const std::vector<std::string>& lines) noexcept;
+
+  // clear the screen and forget the last frame
+  void clear() noexcept;
+
+  // move the cursor below the last frame and show it again
+  void finish() noexcept;
+
+ private:
+  void write_all(const std::string& data) const noexcept;
+
+ private:
+  int fd_;
+  bool drawn_ = false;
+  std::vector<std::string> prev_;
+  std::string buf_;
+};
+
 class Menu {
  public:
   Menu(std::vector<std::string>&& opts) noexcept;
 
+  Menu(const Menu&) = delete;
+
+  Menu& operator=(const Menu&) = delete;
+
+  ~Menu();
+
   void on_opt_show(
       std::function<std::string(int, const std::string&)>&& fn) noexcept {
     opt_fn_ = std::move(fn);
@@ -59,13 +98,54 @@ class Menu {
 
   bool right() noexcept;
 
+  // filter and rank the options by a fuzzy query, empty shows all
+  void filter(const std::string& query);
+
+  // replace the options, keeping the cursor on the same option if it is
+  // still there
+  void set_opts(std::vector<std::string>&& opts);
+
+  // run fn on the thread running main and redraw, so background work can
+  // update what the callbacks show
+  // safe to call from any thread
+  void post(std::function<void()>&& fn);
+
+  // a line shown below the options, such as what background work could not
+  // do, empty for none
+  // from the thread running main, or through post
+  void notice(std::string&& text) noexcept { notice_ = std::move(text); }
+
+ private:
+  // handle the keys of a read, returns false once the menu should close
+  bool handle(const char* keys, size_t size, bool& result);
+
+  // run the functions given to post
+  void run_posted();
+
+  // the option under the cursor, as an index into opts_
+  int current() const noexcept { return view_[idx_]; }
+
  private:
   static constexpr int MAX = 10;
 
+  // index into view_
   int idx_;
   std::vector<std::string> opts_;
+  // the options shown, as indices into opts_
+  std::vector<int> view_;
+  // whether keys are typed into the query
+  bool filtering_ = false;
+  std::string query_;
+  std::string notice_;
+  // built on first use
+  std::unique_ptr<quicky::FuzzyIndex> index_;
   std::function<bool(int, const std::string&)> opt_enter_fn_;
   std::function<std::string(int, const std::string&)> opt_fn_;
+  Renderer renderer_;
+  std::mutex posted_mutex_;
+  std::vector<std::function<void()>> posted_;
+  // written to by post to wake main up
+  int wake_[2] = {-1, -1};
 };
 
 /*
@@ -89,20 +169,152 @@ inline termios& RawMode::backup() noexcept {
   return b;
 }
 
+inline void Renderer::render(const std::vector<std::string>& lines) noexcept {
+  buf_.clear();
+  if (!drawn_) {
+    // hide the cursor and start from a clean screen
+    buf_ += "\x1b[?25l\x1b[H\x1b[2J";
+    drawn_ = true;
+  }
+  for (size_t i = 0; i < lines.size(); ++i) {
+    if (i < prev_.size() && prev_[i] == lines[i]) continue;
+    buf_ += "\x1b[" + std::to_string(i + 1) + ";1H";
+    buf_ += lines[i];
+    buf_ += "\x1b[K";
+  }
+  for (size_t i = lines.size(); i < prev_.size(); ++i) {
+    buf_ += "\x1b[" + std::to_string(i + 1) + ";1H\x1b[2K";
+  }
+  prev_ = lines;
+  if (!buf_.empty()) write_all(buf_);
+}
+
+inline void Renderer::clear() noexcept {
+  write_all("\x1b[H\x1b[2J");
+  prev_.clear();
+}
+
+inline void Renderer::finish() noexcept {
+  write_all("\x1b[" + std::to_string(prev_.size() + 1) + ";1H\x1b[?25h");
+  drawn_ = false;
+  prev_.clear();
+}
+
+inline void Renderer::write_all(const std::string& data) const noexcept {
+  // anything printed through std::cout must come first
+  std::cout.flush();
+  size_t written = 0;
+  while (written < data.size()) {
+    const ssize_t n = write(fd_, data.data() + written, data.size() - written);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return;
+    }
+    written += n;
+  }
+}
+
 inline Menu::Menu(std::vector<std::string>&& opts) noexcept
     : opts_(std::move(opts)),
       idx_(0),
       opt_fn_([](int, const std::string& opt) { return opt; }),
-      opt_enter_fn_([](int, const std::string&) { return true; }) {}
+      opt_enter_fn_([](int, const std::string&) { return true; }) {
+  view_.resize(opts_.size());
+  for (size_t i = 0; i < view_.size(); ++i) view_[i] = i;
+  if (pipe2(wake_, O_CLOEXEC | O_NONBLOCK) != 0) wake_[0] = wake_[1] = -1;
+}
+
+inline Menu::~Menu() {
+  if (wake_[0] >= 0) close(wake_[0]);
+  if (wake_[1] >= 0) close(wake_[1]);
+}
 
 inline bool Menu::main() {
   RawMode::enable();
-  char c;
+  char buf[64];
+  bool result = true;
   show();
-  while ((c = std::getchar())) {
-    if (c == 'q')
+  while (true) {
+    pollfd fds[2] = {{STDIN_FILENO, POLLIN, 0}, {wake_[0], POLLIN, 0}};
+    if (poll(fds, wake_[0] >= 0 ? 2 : 1, -1) < 0) {
+      if (errno == EINTR) continue;
       break;
-    else if (c == 'w')
+    }
+    if (fds[1].revents & POLLIN) run_posted();
+    if (fds[0].revents & (POLLIN | POLLHUP)) {
+      const ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) break;
+      // handle every key already typed before drawing, so held keys are
+      // coalesced into a single frame
+      if (!handle(buf, n, result)) return result;
+      pollfd pfd{STDIN_FILENO, POLLIN, 0};
+      if (poll(&pfd, 1, 0) > 0) continue;
+    }
+    show();
+  }
+  renderer_.finish();
+  return result;
+}
+
+inline void Menu::post(std::function<void()>&& fn) {
+  {
+    std::lock_guard<std::mutex> lock(posted_mutex_);
+    posted_.push_back(std::move(fn));
+  }
+  // a full pipe already wakes main up
+  const char c = 0;
+  if (wake_[1] >= 0) (void)!write(wake_[1], &c, 1);
+}
+
+inline void Menu::run_posted() {
+  char buf[64];
+  while (read(wake_[0], buf, sizeof(buf)) > 0) {
+  }
+  std::vector<std::function<void()>> posted;
+  {
+    std::lock_guard<std::mutex> lock(posted_mutex_);
+    posted.swap(posted_);
+  }
+  for (auto&& fn : posted) fn();
+}
+
+inline bool Menu::handle(const char* keys, size_t size, bool& result) {
+  for (size_t i = 0; i < size; ++i) {
+    const char c = keys[i];
+    if (c == '\x1b' && i + 2 < size && keys[i + 1] == '[') {
+      // arrow keys work in both modes
+      const char arrow = keys[i + 2];
+      i += 2;
+      if (arrow == 'A')
+        up();
+      else if (arrow == 'B')
+        down();
+      else if (arrow == 'D')
+        left();
+      else if (arrow == 'C')
+        right();
+    } else if (c == '\r' || c == '\n') {
+      if (view_.empty()) continue;
+      renderer_.clear();
+      renderer_.finish();
+      result = opt_enter_fn_(current(), opts_[current()]);
+      return false;
+    } else if (filtering_) {
+      if (c == '\x1b') {
+        filtering_ = false;
+        filter("");
+      } else if (c == 127 || c == '\b') {
+        if (!query_.empty()) filter(query_.substr(0, query_.size() - 1));
+      } else if (static_cast<unsigned char>(c) >= ' ') {
+        filter(query_ + c);
+      }
+    } else if (c == 'q') {
+      renderer_.finish();
+      return false;
+    } else if (c == '/') {
+      filtering_ = true;
+    } else if (c == 'w')
       up();
     else if (c == 's')
       down();
@@ -110,54 +322,86 @@ inline bool Menu::main() {
       left();
     else if (c == 'd')
       right();
-    else if (c == '\r' || c == '\n') {
-      std::system("clear");
-      return opt_enter_fn_(idx_, opts_[idx_]);
-    }
   }
   return true;
 }
 
 inline void Menu::show() noexcept {
-  std::system("clear");
   const int start = idx_ / MAX * MAX;
   const int end = idx_ / MAX * MAX + MAX;
-  for (int i = start; i < opts_.size() && i < end; ++i) {
+  std::vector<std::string> lines;
+  lines.reserve(MAX + 4);
+  for (int i = start; i < static_cast<int>(view_.size()) && i < end; ++i) {
+    const int opt = view_[i];
     if (i == idx_) {
-      std::cout << opt_fn_(i, opts_[i]) << " 👈" << std::endl;
+      lines.push_back(opt_fn_(opt, opts_[opt]) + " 👈");
     } else {
-      std::cout << opt_fn_(i, opts_[i]) << std::endl;
+      lines.push_back(opt_fn_(opt, opts_[opt]));
     }
   }
-
-  std::cout << "\n\n\n\nuse `w`, `s`, `a`, `d` to navigate, `enter` to "
-               "enter, `q` to quit.";
+  if (view_.empty()) lines.push_back("no match.");
+  lines.emplace_back();
+  lines.push_back(notice_);
+  if (filtering_) {
+    lines.push_back("/" + query_ + " (" + std::to_string(view_.size()) + "/" +
+                    std::to_string(opts_.size()) + ")");
+    lines.push_back(
+        "type to filter, arrows to navigate, `enter` to enter, `esc` to stop "
+        "filtering.");
+  } else {
+    lines.emplace_back();
+    lines.push_back(
+        "use `w`, `s`, `a`, `d` to navigate, `/` to filter, `enter` to enter, "
+        "`q` to quit.");
+  }
+  renderer_.render(lines);
 }
 
 inline bool Menu::up() noexcept {
   if (idx_ <= 0) return false;
   --idx_;
-  show();
   return true;
 }
 
 inline bool Menu::down() noexcept {
-  if (idx_ >= opts_.size() - 1) return false;
+  if (idx_ >= static_cast<int>(view_.size()) - 1) return false;
   ++idx_;
-  show();
   return true;
 }
 
 inline bool Menu::left() noexcept {
   if (idx_ - MAX < 0) return false;
   idx_ -= MAX;
-  show();
   return true;
 }
 
 inline bool Menu::right() noexcept {
-  if (idx_ + MAX >= opts_.size() - 1) return false;
+  if (idx_ + MAX >= static_cast<int>(view_.size()) - 1) return false;
   idx_ += MAX;
-  show();
   return true;
 }
+
+inline void Menu::set_opts(std::vector<std::string>&& opts) {
+  const std::string selected = view_.empty() ? "" : opts_[current()];
+  opts_ = std::move(opts);
+  index_.reset();
+  filter(query_);
+  for (size_t i = 0; i < view_.size(); ++i) {
+    if (opts_[view_[i]] == selected) {
+      idx_ = i;
+      break;
+    }
+  }
+}
+
+inline void Menu::filter(const std::string& query) {
+  query_ = query;
+  idx_ = 0;
+  if (query_.empty()) {
+    view_.resize(opts_.size());
+    for (size_t i = 0; i < view_.size(); ++i) view_[i] = i;
+    return;
+  }
+  if (!index_) index_ = std::make_unique<quicky::FuzzyIndex>(opts_);
+  view_ = index_->filter(query_);
+}
@@ -0,0 +1,256 @@
+#pragma once
+
+/*
+ * Headers
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*
+ * Declaration
+ */
+
+namespace quicky {
+
+// metrics in the prometheus text format
+// every update is a few relaxed atomic operations without locks, so a scrape
+// reading the metrics never holds up the threads updating them, at the cost
+// of a scrape possibly seeing a histogram between two of its updates
+
+// write the # HELP and # TYPE lines of a metric
+void write_metric_header(std::string& out, std::string_view name,
+                         std::string_view type, std::string_view help);
+
+// write a sample line, labels being like `proxy="a"` or empty
+void write_metric_sample(std::string& out, std::string_view name,
+                         std::string_view labels, double value);
+
+// a label value with backslashes, quotes and line breaks escaped
+std::string escape_label(std::string_view value);
+
+// a value only ever going up
+class Counter {
+ public:
+  void inc(uint64_t n = 1) noexcept {
+    value_.fetch_add(n, std::memory_order_relaxed);
+  }
+
+  uint64_t value() const noexcept {
+    return value_.load(std::memory_order_relaxed);
+  }
+
+  void write(std::string& out, std::string_view name,
+             std::string_view labels = "") const {
+    write_metric_sample(out, name, labels, static_cast<double>(value()));
+  }
+
+ private:
+  std::atomic<uint64_t> value_{0};
+};
+
+// a value going up and down, or one owned by another process like the
+// counters of clash, which are only ever set
+class Gauge {
+ public:
+  void set(double value) noexcept {
+    value_.store(value, std::memory_order_relaxed);
+  }
+
+  double value() const noexcept {
+    return value_.load(std::memory_order_relaxed);
+  }
+
+  void write(std::string& out, std::string_view name,
+             std::string_view labels = "") const {
+    write_metric_sample(out, name, labels, value());
+  }
+
+ private:
+  std::atomic<double> value_{0};
+};
+
+// counts of observations by upper bound, plus their sum
+class Histogram {
+ public:
+  // bounds in ascending order, the +Inf bucket is implied
+  explicit Histogram(std::vector<double> bounds) noexcept
+      : bounds_(std::move(bounds)),
+        buckets_(new std::atomic<uint64_t>[bounds_.size() + 1]()) {}
+
+  void observe(double value) noexcept;
+
+  // the _bucket, _sum and _count lines
+  void write(std::string& out, std::string_view name,
+             std::string_view labels = "") const;
+
+ private:
+  const std::vector<double> bounds_;
+  // not cumulative, added up when written
+  std::unique_ptr<std::atomic<uint64_t>[]> buckets_;
+  std::atomic<double> sum_{0};
+};
+
+// a metric by the value of a label, like the delay of each proxy
+// labels are kept in a fixed number of slots claimed in order, so a metric
+// is found without a lock and never moves once created
+// labels past the capacity share a metric labelled "other"
+template <class T>
+class Family {
+ public:
+  Family(std::string label, size_t capacity,
+         std::function<std::unique_ptr<T>()> make) noexcept
+      : label_(std::move(label)),
+        capacity_(capacity),
+        slots_(new Slot[capacity]),
+        make_(std::move(make)),
+        other_(make_()) {}
+
+  Family(const Family&) = delete;
+
+  Family& operator=(const Family&) = delete;
+
+  // the metric of a label value, created on first use
+  T& at(std::string_view value) noexcept;
+
+  void write(std::string& out, std::string_view name) const;
+
+ private:
+  struct Slot {
+    // 0 free, 1 being filled, 2 ready
+    std::atomic<int> state{0};
+    std::string value;
+    std::unique_ptr<T> metric;
+  };
+
+  const std::string label_;
+  const size_t capacity_;
+  std::unique_ptr<Slot[]> slots_;
+  std::function<std::unique_ptr<T>()> make_;
+  std::unique_ptr<T> other_;
+};
+
+}  // namespace quicky
+
+/*
+ * Implementation of template methods.
+ */
+
+namespace quicky {
+
+template <class T>
+T& Family<T>::at(std::string_view value) noexcept {
+  for (size_t i = 0; i < capacity_; ++i) {
+    auto& slot = slots_[i];
+    int state = slot.state.load(std::memory_order_acquire);
+    if (state == 0) {
+      if (slot.state.compare_exchange_strong(state, 1,
+                                             std::memory_order_acquire)) {
+        slot.value = value;
+        slot.metric = make_();
+        slot.state.store(2, std::memory_order_release);
+        return *slot.metric;
+      }
+    }
+    // another thread is adding a label, which may be this one, and it is
+    // only a string and a metric away
+    while (state == 1) state = slot.state.load(std::memory_order_acquire);
+    if (slot.value == value) return *slot.metric;
+  }
+  return *other_;
+}
+
+template <class T>
+void Family<T>::write(std::string& out, std::string_view name) const {
+  for (size_t i = 0; i < capacity_; ++i) {
+    const auto& slot = slots_[i];
+    if (slot.state.load(std::memory_order_acquire) != 2) break;
+    slot.metric->write(out, name,
+                       label_ + "=\"" + escape_label(slot.value) + "\"");
+  }
+  if (slots_[capacity_ - 1].state.load(std::memory_order_acquire) == 2) {
+    other_->write(out, name, label_ + "=\"other\"");
+  }
+}
+
+}  // namespace quicky
+
+/*
+ * Implementation that will be part of the .cpp file if split into .hpp and .cpp
+ * files.
+ */
+
+namespace quicky {
+
+inline void write_metric_header(std::string& out, std::string_view name,
+                                std::string_view type, std::string_view help) {
+  out.append("# HELP ").append(name).append(" ").append(help).append("\n");
+  out.append("# TYPE ").append(name).append(" ").append(type).append("\n");
+}
+
+inline void write_metric_sample(std::string& out, std::string_view name,
+                                std::string_view labels, double value) {
+  out.append(name);
+  if (!labels.empty()) out.append("{").append(labels).append("}");
+  char buf[32];
+  std::snprintf(buf, sizeof(buf), " %.15g\n", value);
+  out.append(buf);
+}
+
+inline std::string escape_label(std::string_view value) {
+  std::string escaped;
+  escaped.reserve(value.size());
+  for (char c : value) {
+    if (c == '\\' || c == '"') {
+      escaped += '\\';
+      escaped += c;
+    } else if (c == '\n') {
+      escaped += "\\n";
+    } else {
+      escaped += c;
+    }
+  }
+  return escaped;
+}
+
+inline void Histogram::observe(double value) noexcept {
+  size_t i = 0;
+  while (i < bounds_.size() && value > bounds_[i]) ++i;
+  buckets_[i].fetch_add(1, std::memory_order_relaxed);
+  double sum = sum_.load(std::memory_order_relaxed);
+  while (!sum_.compare_exchange_weak(sum, sum + value,
+                                     std::memory_order_relaxed)) {
+  }
+}
+
+inline void Histogram::write(std::string& out, std::string_view name,
+                             std::string_view labels) const {
+  const std::string bucket = std::string(name) + "_bucket";
+  const std::string prefix =
+      labels.empty() ? std::string() : std::string(labels) + ",";
+  uint64_t cumulative = 0;
+  char le[32];
+  for (size_t i = 0; i <= bounds_.size(); ++i) {
+    cumulative += buckets_[i].load(std::memory_order_relaxed);
+    if (i < bounds_.size()) {
+      std::snprintf(le, sizeof(le), "le=\"%g\"", bounds_[i]);
+    } else {
+      std::snprintf(le, sizeof(le), "le=\"+Inf\"");
+    }
+    write_metric_sample(out, bucket, prefix + le,
+                        static_cast<double>(cumulative));
+  }
+  write_metric_sample(out, std::string(name) + "_sum", labels,
+                      sum_.load(std::memory_order_relaxed));
+  // from the buckets, so it agrees with +Inf
+  write_metric_sample(out, std::string(name) + "_count", labels,
+                      static_cast<double>(cumulative));
+}
+
+}  // namespace quicky
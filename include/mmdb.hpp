@@ -0,0 +1,377 @@
+#pragma once
+
+/*
+ * Headers
+ */
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <optional>
+#include <string>
+#include <string_view>
+
+/*
+ * Declaration
+ */
+
+namespace quicky {
+
+// a zero-copy reader of maxmind db files such as the Country.mmdb used by
+// clash
+// the file is mapped into memory and lookups walk the search tree and the
+// data section in place, so nothing is parsed up front and strings are
+// returned as views into the mapping
+class Mmdb {
+ public:
+  Mmdb() noexcept = default;
+
+  Mmdb(const Mmdb&) = delete;
+
+  Mmdb& operator=(const Mmdb&) = delete;
+
+  ~Mmdb() { close(); }
+
+  // map the file and read its metadata
+  bool open(const std::string& filepath) noexcept;
+
+  void close() noexcept;
+
+  bool is_open() const noexcept { return data_ != nullptr; }
+
+  // offset of the record for an ip address in the data section, nullopt if
+  // the address is invalid or not in the database
+  std::optional<uint32_t> find(std::string_view ip) const noexcept;
+
+  // the string at path in the record at offset, e.g. {"country", "iso_code"}
+  std::optional<std::string_view> get_string(
+      uint32_t offset,
+      std::initializer_list<std::string_view> path) const noexcept;
+
+  // the country iso code of an ip address
+  std::optional<std::string_view> country(std::string_view ip) const noexcept {
+    auto offset = find(ip);
+    if (!offset.has_value()) return std::nullopt;
+    return get_string(*offset, {"country", "iso_code"});
+  }
+
+  const std::string& database_type() const noexcept { return database_type_; }
+
+ private:
+  enum Type {
+    extended = 0,
+    pointer = 1,
+    utf8_string = 2,
+    double_ = 3,
+    bytes = 4,
+    uint16 = 5,
+    uint32 = 6,
+    map = 7,
+    int32 = 8,
+    uint64 = 9,
+    uint128 = 10,
+    array = 11,
+    container = 12,
+    end_marker = 13,
+    boolean = 14,
+    float_ = 15,
+  };
+
+  // a decoded control byte
+  struct Field {
+    int type;
+    // length of the payload, entries of a map or array, or the value of a
+    // boolean
+    uint32_t size;
+    // where the payload starts
+    size_t offset;
+  };
+
+  // decode the field at offset of a section starting at base, following
+  // pointers
+  // next is set to the offset right after the field as it is stored, that is
+  // after the pointer if one was followed
+  std::optional<Field> decode(size_t base, size_t offset,
+                              size_t& next) const noexcept;
+
+  // the offset right after the field at offset, skipping nested values
+  std::optional<size_t> skip(size_t base, size_t offset) const noexcept;
+
+  std::optional<uint64_t> get_uint(size_t base, size_t offset) const noexcept;
+
+  // look up key in the map at offset, returns the offset of its value
+  std::optional<size_t> get_key(size_t base, size_t offset,
+                                std::string_view key) const noexcept;
+
+  uint32_t read_record(uint32_t node, int bit) const noexcept;
+
+ private:
+  const uint8_t* data_ = nullptr;
+  size_t size_ = 0;
+  uint32_t node_count_ = 0;
+  uint32_t record_size_ = 0;
+  uint32_t ip_version_ = 0;
+  // where the data section starts
+  size_t data_base_ = 0;
+  // the node reached after 96 zero bits, where ipv4 addresses start in an
+  // ipv6 tree
+  uint32_t ipv4_start_ = 0;
+  std::string database_type_;
+};
+
+}  // namespace quicky
+
+/*
+ * Implementation that will be part of the .cpp file if split into .hpp and .cpp
+ * files.
+ */
+
+namespace quicky {
+
+inline bool Mmdb::open(const std::string& filepath) noexcept {
+  close();
+  const int fd = ::open(filepath.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    ::close(fd);
+    return false;
+  }
+  void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (p == MAP_FAILED) return false;
+  data_ = static_cast<const uint8_t*>(p);
+  size_ = st.st_size;
+
+  // the metadata follows the last marker, within the last 128KiB
+  static constexpr std::string_view marker("\xAB\xCD\xEFMaxMind.com", 14);
+  const std::string_view file(reinterpret_cast<const char*>(data_), size_);
+  const auto pos = file.rfind(marker);
+  if (pos == std::string_view::npos || size_ - pos > 128 * 1024) {
+    close();
+    return false;
+  }
+  const size_t meta = pos + marker.size();
+  auto node_count = get_key(meta, meta, "node_count");
+  auto record_size = get_key(meta, meta, "record_size");
+  auto ip_version = get_key(meta, meta, "ip_version");
+  if (!node_count || !record_size || !ip_version) {
+    close();
+    return false;
+  }
+  node_count_ = get_uint(meta, *node_count).value_or(0);
+  record_size_ = get_uint(meta, *record_size).value_or(0);
+  ip_version_ = get_uint(meta, *ip_version).value_or(0);
+  if (record_size_ != 24 && record_size_ != 28 && record_size_ != 32) {
+    close();
+    return false;
+  }
+  if (auto type = get_key(meta, meta, "database_type")) {
+    size_t next;
+    auto f = decode(meta, *type, next);
+    if (f && f->type == utf8_string) {
+      database_type_.assign(reinterpret_cast<const char*>(data_ + f->offset),
+                            f->size);
+    }
+  }
+
+  const size_t tree_size = size_t(record_size_) * 2 / 8 * node_count_;
+  data_base_ = tree_size + 16;
+  if (data_base_ > pos) {
+    close();
+    return false;
+  }
+
+  ipv4_start_ = 0;
+  if (ip_version_ == 6) {
+    for (int i = 0; i < 96 && ipv4_start_ < node_count_; ++i) {
+      ipv4_start_ = read_record(ipv4_start_, 0);
+    }
+  }
+  return true;
+}
+
+inline void Mmdb::close() noexcept {
+  if (data_) munmap(const_cast<uint8_t*>(data_), size_);
+  data_ = nullptr;
+  size_ = 0;
+}
+
+inline std::optional<uint32_t> Mmdb::find(std::string_view ip) const noexcept {
+  if (!data_ || ip.size() >= INET6_ADDRSTRLEN) return std::nullopt;
+  // inet_pton needs a nul-terminated string
+  char str[INET6_ADDRSTRLEN];
+  std::memcpy(str, ip.data(), ip.size());
+  str[ip.size()] = '\0';
+  uint8_t addr[16];
+  int bits;
+  uint32_t node;
+  if (inet_pton(AF_INET, str, addr) == 1) {
+    bits = 32;
+    node = ip_version_ == 6 ? ipv4_start_ : 0;
+  } else if (ip_version_ == 6 && inet_pton(AF_INET6, str, addr) == 1) {
+    bits = 128;
+    node = 0;
+  } else {
+    return std::nullopt;
+  }
+
+  for (int i = 0; i < bits && node < node_count_; ++i) {
+    const int bit = (addr[i >> 3] >> (7 - (i & 7))) & 1;
+    node = read_record(node, bit);
+  }
+  // node_count itself means not found, anything above points into the data
+  // section
+  if (node <= node_count_) return std::nullopt;
+  const size_t offset = size_t(node) - node_count_ - 16;
+  if (data_base_ + offset >= size_) return std::nullopt;
+  return static_cast<uint32_t>(offset);
+}
+
+inline std::optional<std::string_view> Mmdb::get_string(
+    uint32_t offset,
+    std::initializer_list<std::string_view> path) const noexcept {
+  if (!data_) return std::nullopt;
+  size_t at = data_base_ + offset;
+  for (auto key : path) {
+    auto value = get_key(data_base_, at, key);
+    if (!value.has_value()) return std::nullopt;
+    at = *value;
+  }
+  size_t next;
+  auto f = decode(data_base_, at, next);
+  if (!f || f->type != utf8_string) return std::nullopt;
+  return std::string_view(reinterpret_cast<const char*>(data_ + f->offset),
+                          f->size);
+}
+
+inline std::optional<Mmdb::Field> Mmdb::decode(size_t base, size_t offset,
+                                               size_t& next) const noexcept {
+  // a pointer is never followed by another pointer
+  for (int hops = 0; hops < 2; ++hops) {
+    if (offset >= size_) return std::nullopt;
+    const uint8_t ctrl = data_[offset++];
+    int type = ctrl >> 5;
+
+    if (type == pointer) {
+      const int ss = (ctrl >> 3) & 3;
+      if (offset + ss + 1 > size_) return std::nullopt;
+      uint32_t p = ctrl & 7;
+      if (ss == 3) p = 0;
+      for (int i = 0; i <= ss; ++i) p = (p << 8) | data_[offset++];
+      static constexpr uint32_t bias[] = {0, 2048, 526336, 0};
+      p += bias[ss];
+      // only the outermost position counts for the caller
+      if (hops == 0) next = offset;
+      offset = base + p;
+      continue;
+    }
+
+    if (type == extended) {
+      if (offset >= size_) return std::nullopt;
+      type = 7 + data_[offset++];
+    }
+    uint32_t size = ctrl & 0x1f;
+    if (size >= 29) {
+      const int n = size - 28;
+      if (offset + n > size_) return std::nullopt;
+      uint32_t v = 0;
+      for (int i = 0; i < n; ++i) v = (v << 8) | data_[offset++];
+      static constexpr uint32_t bias[] = {0, 29, 285, 65821};
+      size = v + bias[n];
+    }
+
+    size_t payload = 0;
+    if (type != map && type != array && type != boolean) payload = size;
+    if (type == double_) payload = 8;
+    if (type == float_) payload = 4;
+    if (offset + payload > size_) return std::nullopt;
+    if (hops == 0) next = offset + payload;
+    return Field{type, size, offset};
+  }
+  return std::nullopt;
+}
+
+inline std::optional<size_t> Mmdb::skip(size_t base,
+                                        size_t offset) const noexcept {
+  size_t next;
+  auto f = decode(base, offset, next);
+  if (!f.has_value()) return std::nullopt;
+  // a followed pointer is skipped as a whole
+  if (data_[offset] >> 5 == pointer) return next;
+  if (f->type == map || f->type == array) {
+    size_t at = f->offset;
+    const uint64_t n = f->type == map ? uint64_t(f->size) * 2 : f->size;
+    for (uint64_t i = 0; i < n; ++i) {
+      auto after = skip(base, at);
+      if (!after.has_value()) return std::nullopt;
+      at = *after;
+    }
+    return at;
+  }
+  return next;
+}
+
+inline std::optional<uint64_t> Mmdb::get_uint(size_t base,
+                                              size_t offset) const noexcept {
+  size_t next;
+  auto f = decode(base, offset, next);
+  if (!f || (f->type != uint16 && f->type != uint32 && f->type != uint64) ||
+      f->size > 8) {
+    return std::nullopt;
+  }
+  uint64_t v = 0;
+  for (uint32_t i = 0; i < f->size; ++i) v = (v << 8) | data_[f->offset + i];
+  return v;
+}
+
+inline std::optional<size_t> Mmdb::get_key(
+    size_t base, size_t offset, std::string_view key) const noexcept {
+  size_t next;
+  auto f = decode(base, offset, next);
+  if (!f || f->type != map) return std::nullopt;
+  size_t at = f->offset;
+  for (uint32_t i = 0; i < f->size; ++i) {
+    size_t after_key;
+    auto k = decode(base, at, after_key);
+    if (!k || k->type != utf8_string) return std::nullopt;
+    if (key ==
+        std::string_view(reinterpret_cast<const char*>(data_ + k->offset),
+                         k->size)) {
+      return after_key;
+    }
+    auto after_value = skip(base, after_key);
+    if (!after_value.has_value()) return std::nullopt;
+    at = *after_value;
+  }
+  return std::nullopt;
+}
+
+inline uint32_t Mmdb::read_record(uint32_t node, int bit) const noexcept {
+  const uint8_t* p = data_ + size_t(node) * record_size_ / 4;
+  switch (record_size_) {
+    case 24:
+      p += bit * 3;
+      return uint32_t(p[0]) << 16 | uint32_t(p[1]) << 8 | p[2];
+    case 28:
+      // the middle byte holds the high nibble of both records
+      if (bit == 0) {
+        return uint32_t(p[3] >> 4) << 24 | uint32_t(p[0]) << 16 |
+               uint32_t(p[1]) << 8 | p[2];
+      }
+      return uint32_t(p[3] & 0x0f) << 24 | uint32_t(p[4]) << 16 |
+             uint32_t(p[5]) << 8 | p[6];
+    default:
+      p += bit * 4;
+      return uint32_t(p[0]) << 24 | uint32_t(p[1]) << 16 |
+             uint32_t(p[2]) << 8 | p[3];
+  }
+}
+
+}  // namespace quicky
@@ -0,0 +1,232 @@
+#pragma once
+
+/*
+ * Headers
+ */
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+/*
+ * Declaration
+ */
+
+namespace quicky {
+
+// splits a stream of chunks into lines, as the streaming endpoints of clash
+// send one json object per line
+// complete lines inside a chunk are passed on as views into the chunk, only a
+// line split across chunks is copied, into a buffer allocated once
+class LineSplitter {
+ public:
+  // lines longer than max_line are dropped
+  explicit LineSplitter(size_t max_line = 1 << 16) : max_line_(max_line) {
+    buf_.reserve(max_line_);
+  }
+
+  // call fn(std::string_view) for every line completed by a chunk, without
+  // the line break
+  // stops and returns false as soon as fn returns false
+  template <class Fn>
+  bool feed(const char* data, size_t size, Fn&& fn);
+
+ private:
+  const size_t max_line_;
+  // the start of a line waiting for the rest of it
+  std::string buf_;
+  // whether the rest of an overlong line is being dropped
+  bool skipping_ = false;
+};
+
+// the unsigned integer value of key in a flat json object, such as "up" in
+// {"up":1024,"down":2048}, nullopt if it is missing or not a number
+// keys are matched as written, escaped keys are not supported
+std::optional<uint64_t> json_uint(std::string_view object,
+                                  std::string_view key) noexcept;
+
+// the unescaped string value of key in a flat json object, written into out
+// so its memory is reused across lines
+// returns false if it is missing or not a string
+bool json_string(std::string_view object, std::string_view key,
+                 std::string& out);
+
+}  // namespace quicky
+
+/*
+ * Implementation of template methods.
+ */
+
+namespace quicky {
+
+template <class Fn>
+bool LineSplitter::feed(const char* data, size_t size, Fn&& fn) {
+  std::string_view chunk(data, size);
+  size_t begin = 0;
+  for (size_t end; (end = chunk.find('\n', begin)) != chunk.npos;
+       begin = end + 1) {
+    auto line = chunk.substr(begin, end - begin);
+    if (skipping_) {
+      skipping_ = false;
+      continue;
+    }
+    if (!buf_.empty()) {
+      if (buf_.size() + line.size() > max_line_) {
+        buf_.clear();
+        continue;
+      }
+      buf_.append(line);
+      line = buf_;
+    }
+    if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+    const bool more = line.empty() || fn(line);
+    buf_.clear();
+    if (!more) return false;
+  }
+
+  const auto rest = chunk.substr(begin);
+  if (skipping_ || rest.empty()) return true;
+  if (buf_.size() + rest.size() > max_line_) {
+    buf_.clear();
+    skipping_ = true;
+  } else {
+    buf_.append(rest);
+  }
+  return true;
+}
+
+}  // namespace quicky
+
+/*
+ * Implementation that will be part of the .cpp file if split into .hpp and .cpp
+ * files.
+ */
+
+namespace quicky {
+
+namespace detail {
+
+// where the value of key starts in a flat json object, npos if missing
+inline size_t json_value(std::string_view object,
+                         std::string_view key) noexcept {
+  for (size_t at = object.find(key); at != object.npos;
+       at = object.find(key, at + 1)) {
+    if (at == 0 || object[at - 1] != '"' || at + key.size() >= object.size() ||
+        object[at + key.size()] != '"') {
+      continue;
+    }
+    size_t i = at + key.size() + 1;
+    while (i < object.size() && object[i] == ' ') ++i;
+    if (i >= object.size() || object[i] != ':') continue;
+    ++i;
+    while (i < object.size() && object[i] == ' ') ++i;
+    return i < object.size() ? i : object.npos;
+  }
+  return object.npos;
+}
+
+inline int hex_digit(char c) noexcept {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+// the code unit of a \uXXXX escape starting at i, -1 if malformed
+inline long json_code_unit(std::string_view s, size_t i) noexcept {
+  if (i + 6 > s.size() || s[i] != '\\' || s[i + 1] != 'u') return -1;
+  long unit = 0;
+  for (size_t k = i + 2; k < i + 6; ++k) {
+    const int d = hex_digit(s[k]);
+    if (d < 0) return -1;
+    unit = unit * 16 + d;
+  }
+  return unit;
+}
+
+inline void append_utf8(std::string& out, unsigned long cp) {
+  if (cp < 0x80) {
+    out += static_cast<char>(cp);
+  } else if (cp < 0x800) {
+    out += static_cast<char>(0xc0 | (cp >> 6));
+    out += static_cast<char>(0x80 | (cp & 0x3f));
+  } else if (cp < 0x10000) {
+    out += static_cast<char>(0xe0 | (cp >> 12));
+    out += static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+    out += static_cast<char>(0x80 | (cp & 0x3f));
+  } else {
+    out += static_cast<char>(0xf0 | (cp >> 18));
+    out += static_cast<char>(0x80 | ((cp >> 12) & 0x3f));
+    out += static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+    out += static_cast<char>(0x80 | (cp & 0x3f));
+  }
+}
+
+}  // namespace detail
+
+inline std::optional<uint64_t> json_uint(std::string_view object,
+                                         std::string_view key) noexcept {
+  size_t i = detail::json_value(object, key);
+  if (i == object.npos || object[i] < '0' || object[i] > '9') {
+    return std::nullopt;
+  }
+  uint64_t value = 0;
+  for (; i < object.size() && object[i] >= '0' && object[i] <= '9'; ++i) {
+    value = value * 10 + (object[i] - '0');
+  }
+  return value;
+}
+
+inline bool json_string(std::string_view object, std::string_view key,
+                        std::string& out) {
+  size_t i = detail::json_value(object, key);
+  if (i == object.npos || object[i] != '"') return false;
+  out.clear();
+  for (++i; i < object.size(); ++i) {
+    const char c = object[i];
+    if (c == '"') return true;
+    if (c != '\\') {
+      out += c;
+      continue;
+    }
+    if (++i >= object.size()) return false;
+    switch (object[i]) {
+      case 'b':
+        out += '\b';
+        break;
+      case 'f':
+        out += '\f';
+        break;
+      case 'n':
+        out += '\n';
+        break;
+      case 'r':
+        out += '\r';
+        break;
+      case 't':
+        out += '\t';
+        break;
+      case 'u': {
+        long unit = detail::json_code_unit(object, i - 1);
+        if (unit < 0) return false;
+        i += 4;
+        unsigned long cp = unit;
+        // a surrogate pair encodes a code point beyond the first plane
+        const long low = detail::json_code_unit(object, i + 1);
+        if (unit >= 0xd800 && unit < 0xdc00 && low >= 0xdc00 && low < 0xe000) {
+          cp = 0x10000 + ((unit - 0xd800) << 10) + (low - 0xdc00);
+          i += 6;
+        }
+        detail::append_utf8(out, cp);
+        break;
+      }
+      default:
+        out += object[i];
+        break;
+    }
+  }
+  return false;
+}
+
+}  // namespace quicky
@@ -0,0 +1,218 @@
+#pragma once
+
+/*
+ * Headers
+ */
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <string>
+#include <utility>
+
+/*
+ * Declaration
+ */
+
+namespace quicky {
+
+// split "host:port" into its parts, port is 0 if missing or invalid
+std::pair<std::string, int> split_host_port(
+    const std::string& endpoint) noexcept;
+
+// an owned tcp socket
+class Socket {
+ public:
+  Socket() noexcept = default;
+
+  explicit Socket(int fd) noexcept : fd_(fd) {}
+
+  Socket(Socket&& other) noexcept : fd_(std::exchange(other.fd_, -1)) {}
+
+  Socket& operator=(Socket&& other) noexcept;
+
+  Socket(const Socket&) = delete;
+
+  Socket& operator=(const Socket&) = delete;
+
+  ~Socket() { close(); }
+
+  // connect to host:port, giving up after timeout
+  static Socket connect(const std::string& host, int port,
+                        std::chrono::milliseconds timeout) noexcept;
+
+  // connect to a unix domain socket, invalid if nothing listens on it
+  static Socket connect_unix(const std::string& path) noexcept;
+
+  // listen on a unix domain socket, which must not exist yet
+  static Socket listen_unix(const std::string& path) noexcept;
+
+  // accept a connection, invalid on error
+  Socket accept() const noexcept;
+
+  // send all of data, false on error or timeout
+  bool send_all(const std::string& data,
+                std::chrono::milliseconds timeout) const noexcept;
+
+  // wait for data and receive at most size bytes
+  // returns the number of bytes read, 0 on eof and -1 on error or timeout
+  ssize_t recv_some(char* buf, size_t size,
+                    std::chrono::milliseconds timeout) const noexcept;
+
+  bool valid() const noexcept { return fd_ >= 0; }
+
+  int fd() const noexcept { return fd_; }
+
+  void close() noexcept;
+
+ private:
+  int fd_ = -1;
+};
+
+}  // namespace quicky
+
+/*
+ * Implementation that will be part of the .cpp file if split into .hpp and .cpp
+ * files.
+ */
+
+namespace quicky {
+
+inline std::pair<std::string, int> split_host_port(
+    const std::string& endpoint) noexcept {
+  auto pos = endpoint.rfind(':');
+  if (pos == std::string::npos) return {endpoint, 0};
+  int port = 0;
+  for (size_t i = pos + 1; i < endpoint.size(); ++i) {
+    if (endpoint[i] < '0' || endpoint[i] > '9') return {endpoint, 0};
+    port = port * 10 + (endpoint[i] - '0');
+  }
+  return {endpoint.substr(0, pos), port};
+}
+
+inline Socket& Socket::operator=(Socket&& other) noexcept {
+  if (this != &other) {
+    close();
+    fd_ = std::exchange(other.fd_, -1);
+  }
+  return *this;
+}
+
+inline void Socket::close() noexcept {
+  if (fd_ >= 0) ::close(fd_);
+  fd_ = -1;
+}
+
+inline bool Socket::send_all(
+    const std::string& data, std::chrono::milliseconds timeout) const noexcept {
+  size_t sent = 0;
+  while (sent < data.size()) {
+    pollfd pfd{fd_, POLLOUT, 0};
+    if (poll(&pfd, 1, static_cast<int>(timeout.count())) <= 0) return false;
+    const ssize_t n =
+        ::send(fd_, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR || errno == EAGAIN) continue;
+      return false;
+    }
+    sent += n;
+  }
+  return true;
+}
+
+inline ssize_t Socket::recv_some(
+    char* buf, size_t size, std::chrono::milliseconds timeout) const noexcept {
+  pollfd pfd{fd_, POLLIN, 0};
+  if (poll(&pfd, 1, static_cast<int>(timeout.count())) <= 0) return -1;
+  ssize_t n;
+  do {
+    n = ::recv(fd_, buf, size, 0);
+  } while (n < 0 && errno == EINTR);
+  return n;
+}
+
+inline Socket Socket::connect(const std::string& host, int port,
+                              std::chrono::milliseconds timeout) noexcept {
+  addrinfo hints{};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* res = nullptr;
+  const auto service = std::to_string(port);
+  if (getaddrinfo(host.c_str(), service.c_str(), &hints, &res) != 0) {
+    return Socket();
+  }
+
+  Socket sock;
+  for (auto ai = res; ai; ai = ai->ai_next) {
+    Socket s(::socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC,
+                      ai->ai_protocol));
+    if (!s.valid()) continue;
+
+    // connect without blocking so that the timeout can be enforced
+    const int flags = fcntl(s.fd(), F_GETFL, 0);
+    fcntl(s.fd(), F_SETFL, flags | O_NONBLOCK);
+    if (::connect(s.fd(), ai->ai_addr, ai->ai_addrlen) < 0) {
+      if (errno != EINPROGRESS) continue;
+      pollfd pfd{s.fd(), POLLOUT, 0};
+      if (poll(&pfd, 1, static_cast<int>(timeout.count())) <= 0) continue;
+      int err = 0;
+      socklen_t len = sizeof(err);
+      getsockopt(s.fd(), SOL_SOCKET, SO_ERROR, &err, &len);
+      if (err != 0) continue;
+    }
+    fcntl(s.fd(), F_SETFL, flags);
+    sock = std::move(s);
+    break;
+  }
+  freeaddrinfo(res);
+  return sock;
+}
+
+// fills addr, false if path does not fit
+inline bool unix_address(const std::string& path, sockaddr_un& addr) noexcept {
+  addr = sockaddr_un{};
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path)) return false;
+  path.copy(addr.sun_path, path.size());
+  return true;
+}
+
+inline Socket Socket::connect_unix(const std::string& path) noexcept {
+  sockaddr_un addr;
+  if (!unix_address(path, addr)) return Socket();
+  Socket s(::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+  if (!s.valid()) return s;
+  // local connects finish or fail right away
+  if (::connect(s.fd(), reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+    return Socket();
+  }
+  return s;
+}
+
+inline Socket Socket::listen_unix(const std::string& path) noexcept {
+  sockaddr_un addr;
+  if (!unix_address(path, addr)) return Socket();
+  Socket s(::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+  if (!s.valid()) return s;
+  if (::bind(s.fd(), reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 ||
+      ::listen(s.fd(), 64) < 0) {
+    return Socket();
+  }
+  return s;
+}
+
+inline Socket Socket::accept() const noexcept {
+  int fd;
+  do {
+    fd = ::accept4(fd_, nullptr, nullptr, SOCK_CLOEXEC);
+  } while (fd < 0 && errno == EINTR);
+  return Socket(fd);
+}
+
+}  // namespace quicky
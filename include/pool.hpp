@@ -0,0 +1,133 @@
+#pragma once
+
+/*
+ * Headers
+ */
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "third-party/yhirose/httplib.h"
+
+/*
+ * Declaration
+ */
+
+namespace quicky {
+
+// a thread-safe pool of keep-alive http clients to a single endpoint
+// each caller leases a client for the duration of its requests, so the tcp
+// connection is reused across calls and parallel callers never share a socket
+// timeouts set during a lease are back to the defaults for the next one
+class ClientPool {
+ public:
+  class Lease {
+   public:
+    Lease(ClientPool& pool, std::unique_ptr<httplib::Client>&& cli) noexcept
+        : pool_(pool),
+          cli_(std::move(cli)),
+          start_(std::chrono::steady_clock::now()) {}
+
+    Lease(const Lease&) = delete;
+
+    Lease& operator=(const Lease&) = delete;
+
+    ~Lease() {
+      if (timed_ && pool_.on_release_) {
+        pool_.on_release_(std::chrono::steady_clock::now() - start_);
+      }
+      // a lease may set timeouts for its own requests, which must not carry
+      // over to the next one
+      cli_->set_connection_timeout(CPPHTTPLIB_CONNECTION_TIMEOUT_SECOND,
+                                   CPPHTTPLIB_CONNECTION_TIMEOUT_USECOND);
+      cli_->set_read_timeout(CPPHTTPLIB_READ_TIMEOUT_SECOND,
+                             CPPHTTPLIB_READ_TIMEOUT_USECOND);
+      cli_->set_write_timeout(CPPHTTPLIB_WRITE_TIMEOUT_SECOND,
+                              CPPHTTPLIB_WRITE_TIMEOUT_USECOND);
+      pool_.release(std::move(cli_));
+    }
+
+    httplib::Client* operator->() const noexcept { return cli_.get(); }
+
+    httplib::Client& operator*() const noexcept { return *cli_; }
+
+    // leave the lease out of on_release, for requests whose duration is not
+    // up to the endpoint, like a delay test waiting on a proxy
+    void untimed() noexcept { timed_ = false; }
+
+   private:
+    ClientPool& pool_;
+    std::unique_ptr<httplib::Client> cli_;
+    std::chrono::steady_clock::time_point start_;
+    bool timed_ = true;
+  };
+
+  explicit ClientPool(const std::string& endpoint,
+                      size_t max_idle = 32) noexcept
+      : endpoint_(endpoint), max_idle_(max_idle) {}
+
+  ClientPool(const ClientPool&) = delete;
+
+  ClientPool& operator=(const ClientPool&) = delete;
+
+  // take an idle client or create a new one
+  Lease acquire();
+
+  // call fn with how long each lease was held, which is how long its
+  // requests took, as a lease is taken per call
+  // set it before the first acquire, fn may be called from any thread
+  void on_release(
+      std::function<void(std::chrono::steady_clock::duration)>&& fn) noexcept {
+    on_release_ = std::move(fn);
+  }
+
+ private:
+  // give a client back, dropping it if the pool is full
+  void release(std::unique_ptr<httplib::Client>&& cli) noexcept;
+
+ private:
+  const std::string endpoint_;
+  const size_t max_idle_;
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<httplib::Client>> idle_;
+  std::function<void(std::chrono::steady_clock::duration)> on_release_;
+};
+
+}  // namespace quicky
+
+/*
+ * Implementation that will be part of the .cpp file if split into .hpp and .cpp
+ * files.
+ */
+
+namespace quicky {
+
+inline ClientPool::Lease ClientPool::acquire() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!idle_.empty()) {
+      auto cli = std::move(idle_.back());
+      idle_.pop_back();
+      return Lease(*this, std::move(cli));
+    }
+  }
+  auto cli = std::make_unique<httplib::Client>(endpoint_);
+  cli->set_keep_alive(true);
+  // requests with a body go out in two writes, which nagle would hold back
+  // until the delayed ack of the first
+  cli->set_tcp_nodelay(true);
+  return Lease(*this, std::move(cli));
+}
+
+inline void ClientPool::release(
+    std::unique_ptr<httplib::Client>&& cli) noexcept {
+  if (!cli) return;
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (idle_.size() < max_idle_) idle_.push_back(std::move(cli));
+}
+
+}  // namespace quicky
@@ -0,0 +1,352 @@
+#pragma once
+
+/*
+ * Headers
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "json_extract.hpp"
+#include "third-party/nlohmann/json.hpp"
+
+/*
+ * Declaration
+ */
+
+namespace clashctl {
+
+// the proxies and groups of clash, as one /proxies snapshot
+// every proxy and group is stored once and looked up by name through an
+// index, group members are indices into the same storage
+// not thread-safe
+class ProxyModel {
+ public:
+  struct Proxy {
+    std::string name;
+    // like "Selector", "URLTest" or "Shadowsocks"
+    std::string type;
+    // the selected member, groups only
+    std::string now;
+    // the members, as indices into the model, groups only
+    std::vector<size_t> all;
+    // the delays of the latest tests in milliseconds, oldest first, 0 for a
+    // failed test
+    std::vector<int> history;
+
+    bool is_group() const noexcept { return !all.empty(); }
+  };
+
+  // build the model from the body of GET /proxies, a string or a stream
+  // only the fields of the model are extracted, the rest of the body, like
+  // the times of the delay tests, is never stored
+  // throws if it is not valid json
+  template <class Input>
+  static ProxyModel parse(Input&& body);
+
+  // write the model to a compact binary file, atomically
+  bool save(const std::string& filepath) const noexcept;
+
+  // read a model written by save, nullopt if it is missing or invalid
+  static std::optional<ProxyModel> load(const std::string& filepath) noexcept;
+
+  size_t size() const noexcept { return proxies_.size(); }
+
+  const Proxy& operator[](size_t i) const noexcept { return proxies_[i]; }
+
+  std::optional<size_t> find(std::string_view name) const noexcept;
+
+  // the names of the members of a group
+  std::vector<std::string> members(size_t group) const;
+
+  // the delay of the latest test of a proxy, nullopt if never tested or
+  // the test failed
+  std::optional<int> last_delay(std::string_view name) const noexcept;
+
+  // the group used to pick a proxy
+  // preferred if it is a group, otherwise the selector with the most members
+  // that are proxies rather than groups
+  std::optional<size_t> proxy_group(std::string_view preferred) const noexcept;
+
+  // the group used to switch between going direct and going through the
+  // proxy group
+  // preferred if it is a group, otherwise the smallest selector offering
+  // both DIRECT and the proxy group
+  std::optional<size_t> mode_group(std::string_view preferred,
+                                   size_t proxy_group) const noexcept;
+
+  // record the selection of a group after it was changed on clash
+  void select(size_t group, const std::string& name) noexcept {
+    proxies_[group].now = name;
+  }
+
+ private:
+  // bumped whenever the layout of the file written by save changes
+  static constexpr uint32_t version = 1;
+
+  // the index of name, adding an empty proxy if it is not known yet
+  size_t intern(const std::string& name);
+
+  // whether a group can be switched by hand
+  bool is_selector(size_t i) const noexcept {
+    // GLOBAL lists every group and is only used in global mode
+    return proxies_[i].is_group() && proxies_[i].type == "Selector" &&
+           proxies_[i].name != "GLOBAL";
+  }
+
+ private:
+  std::vector<Proxy> proxies_;
+  std::unordered_map<std::string, size_t> index_;
+};
+
+}  // namespace clashctl
+
+/*
+ * Implementation of template methods.
+ */
+
+namespace clashctl {
+
+template <class Input>
+ProxyModel ProxyModel::parse(Input&& body) {
+  ProxyModel model;
+  // the proxy the last values belonged to, they come grouped by proxy
+  std::string name;
+  size_t i = 0;
+  quicky::JsonExtractor extractor(
+      {{"proxies", "*", "type"},
+       {"proxies", "*", "now"},
+       {"proxies", "*", "all", "*"},
+       {"proxies", "*", "history", "*", "delay"}},
+      [&](const std::vector<std::string>& keys, nlohmann::json&& value) {
+        if (keys[1] != name || model.proxies_.empty()) {
+          name = keys[1];
+          i = model.intern(name);
+        }
+        const auto& field = keys[2];
+        if (field == "all" && value.is_string()) {
+          const size_t member = model.intern(value.get<std::string>());
+          model.proxies_[i].all.push_back(member);
+          return;
+        }
+        auto& proxy = model.proxies_[i];
+        if (field == "type" && value.is_string()) {
+          proxy.type = value.get<std::string>();
+        } else if (field == "now" && value.is_string()) {
+          proxy.now = value.get<std::string>();
+        } else if (field == "history" && value.is_number()) {
+          proxy.history.push_back(value.get<int>());
+        }
+      });
+  if (!nlohmann::json::sax_parse(std::forward<Input>(body), &extractor)) {
+    throw std::invalid_argument("invalid proxies: " + extractor.error());
+  }
+  return model;
+}
+
+}  // namespace clashctl
+
+/*
+ * Implementation that will be part of the .cpp file if split into .hpp and .cpp
+ * files.
+ */
+
+namespace clashctl {
+
+// the file holds a header, then every proxy in order
+//   "CCPM" version:u32 count:u32
+//   name type now:str all:u32[] history:i32[]
+// where str is a u32 length and the bytes, and arrays are a u32 length and
+// the elements, all in native byte order as the file never leaves the machine
+inline bool ProxyModel::save(const std::string& filepath) const noexcept {
+  std::string buf;
+  auto put = [&](uint32_t v) {
+    buf.append(reinterpret_cast<const char*>(&v), sizeof(v));
+  };
+  auto put_str = [&](const std::string& str) {
+    put(str.size());
+    buf += str;
+  };
+  try {
+    buf += "CCPM";
+    put(version);
+    put(proxies_.size());
+    for (auto&& p : proxies_) {
+      put_str(p.name);
+      put_str(p.type);
+      put_str(p.now);
+      put(p.all.size());
+      for (auto i : p.all) put(i);
+      put(p.history.size());
+      for (auto d : p.history) put(static_cast<uint32_t>(d));
+    }
+  } catch (const std::exception& e) {
+    return false;
+  }
+
+  // a temporary file of its own, so concurrent saves never write into the
+  // same file, and the last rename wins with a whole snapshot
+  std::string tmp = filepath + ".XXXXXX";
+  const int fd = mkstemp(tmp.data());
+  if (fd < 0) return false;
+  bool ok = true;
+  for (size_t at = 0; ok && at < buf.size();) {
+    const ssize_t n = ::write(fd, buf.data() + at, buf.size() - at);
+    if (n < 0 && errno == EINTR) continue;
+    ok = n > 0;
+    if (ok) at += n;
+  }
+  ok = ::close(fd) == 0 && ok;
+  if (ok && std::rename(tmp.c_str(), filepath.c_str()) == 0) return true;
+  unlink(tmp.c_str());
+  return false;
+}
+
+inline std::optional<ProxyModel> ProxyModel::load(
+    const std::string& filepath) noexcept {
+  try {
+    std::ifstream f(filepath, std::ios::binary);
+    if (!f) return std::nullopt;
+    const std::string buf((std::istreambuf_iterator<char>(f)),
+                          std::istreambuf_iterator<char>());
+    size_t at = 0;
+    bool ok = true;
+    auto get = [&]() -> uint32_t {
+      uint32_t v = 0;
+      if (at + sizeof(v) > buf.size()) {
+        ok = false;
+        return 0;
+      }
+      std::memcpy(&v, buf.data() + at, sizeof(v));
+      at += sizeof(v);
+      return v;
+    };
+    auto get_str = [&](std::string& str) {
+      const uint32_t n = get();
+      if (!ok || at + n > buf.size()) {
+        ok = false;
+        return;
+      }
+      str.assign(buf, at, n);
+      at += n;
+    };
+
+    if (buf.compare(0, 4, "CCPM") != 0) return std::nullopt;
+    at = 4;
+    if (get() != version || !ok) return std::nullopt;
+    const uint32_t count = get();
+    // every proxy takes at least 5 lengths
+    if (!ok || count > (buf.size() - at) / 20) return std::nullopt;
+    ProxyModel model;
+    model.proxies_.resize(count);
+    for (uint32_t i = 0; i < count && ok; ++i) {
+      auto& p = model.proxies_[i];
+      get_str(p.name);
+      get_str(p.type);
+      get_str(p.now);
+      const uint32_t all = get();
+      if (!ok || all > (buf.size() - at) / 4) return std::nullopt;
+      p.all.resize(all);
+      for (auto& m : p.all) {
+        m = get();
+        if (m >= count) return std::nullopt;
+      }
+      const uint32_t history = get();
+      if (!ok || history > (buf.size() - at) / 4) return std::nullopt;
+      p.history.resize(history);
+      for (auto& d : p.history) d = static_cast<int32_t>(get());
+      model.index_.emplace(p.name, i);
+    }
+    if (!ok || at != buf.size()) return std::nullopt;
+    return model;
+  } catch (const std::exception& e) {
+    return std::nullopt;
+  }
+}
+
+inline std::optional<size_t> ProxyModel::find(
+    std::string_view name) const noexcept {
+  auto it = index_.find(std::string(name));
+  if (it == index_.end()) return std::nullopt;
+  return it->second;
+}
+
+inline std::vector<std::string> ProxyModel::members(size_t group) const {
+  std::vector<std::string> names;
+  names.reserve(proxies_[group].all.size());
+  for (auto i : proxies_[group].all) names.push_back(proxies_[i].name);
+  return names;
+}
+
+inline std::optional<int> ProxyModel::last_delay(
+    std::string_view name) const noexcept {
+  auto i = find(name);
+  if (!i.has_value() || proxies_[*i].history.empty()) return std::nullopt;
+  const int delay = proxies_[*i].history.back();
+  if (delay <= 0) return std::nullopt;
+  return delay;
+}
+
+inline std::optional<size_t> ProxyModel::proxy_group(
+    std::string_view preferred) const noexcept {
+  auto i = find(preferred);
+  if (i.has_value() && proxies_[*i].is_group()) return i;
+  std::optional<size_t> best;
+  size_t best_count = 0;
+  for (size_t g = 0; g < proxies_.size(); ++g) {
+    if (!is_selector(g)) continue;
+    size_t count = 0;
+    for (auto m : proxies_[g].all) count += !proxies_[m].is_group();
+    if (!best || count > best_count) {
+      best = g;
+      best_count = count;
+    }
+  }
+  return best;
+}
+
+inline std::optional<size_t> ProxyModel::mode_group(
+    std::string_view preferred, size_t proxy_group) const noexcept {
+  auto i = find(preferred);
+  if (i.has_value() && proxies_[*i].is_group()) return i;
+  const auto direct = find("DIRECT");
+  std::optional<size_t> best;
+  for (size_t g = 0; g < proxies_.size(); ++g) {
+    if (g == proxy_group || !is_selector(g)) continue;
+    const auto& all = proxies_[g].all;
+    const bool has_direct =
+        direct && std::find(all.begin(), all.end(), *direct) != all.end();
+    const bool has_proxies =
+        std::find(all.begin(), all.end(), proxy_group) != all.end();
+    if (has_direct && has_proxies &&
+        (!best || all.size() < proxies_[*best].all.size())) {
+      best = g;
+    }
+  }
+  return best;
+}
+
+inline size_t ProxyModel::intern(const std::string& name) {
+  auto [it, inserted] = index_.try_emplace(name, proxies_.size());
+  if (inserted) {
+    proxies_.emplace_back();
+    proxies_.back().name = name;
+  }
+  return it->second;
+}
+
+}  // namespace clashctl
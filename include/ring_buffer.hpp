@@ -0,0 +1,98 @@
+#pragma once
+
+/*
+ * Headers
+ */
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+/*
+ * Declaration
+ */
+
+namespace quicky {
+
+// a fixed-capacity buffer keeping the last `capacity` values pushed
+// storage is allocated once, pushing into a full buffer overwrites the oldest
+// value
+template <class T>
+class RingBuffer {
+ public:
+  explicit RingBuffer(size_t capacity) : data_(capacity ? capacity : 1) {}
+
+  // push a value, returns true if the oldest one was dropped to make room
+  bool push(const T& value) noexcept;
+
+  bool push(T&& value) noexcept;
+
+  // the slot of a new value, to be filled in place so it reuses the memory
+  // of the value it replaces
+  // dropped is set to whether the oldest value was dropped to make room
+  T& push_slot(bool& dropped) noexcept;
+
+  // the i-th value, from the oldest
+  const T& operator[](size_t i) const noexcept {
+    return data_[(head_ + i) % data_.size()];
+  }
+
+  T& operator[](size_t i) noexcept { return data_[(head_ + i) % data_.size()]; }
+
+  // the newest value, the buffer must not be empty
+  const T& back() const noexcept { return (*this)[size_ - 1]; }
+
+  size_t size() const noexcept { return size_; }
+
+  size_t capacity() const noexcept { return data_.size(); }
+
+  bool empty() const noexcept { return size_ == 0; }
+
+  bool full() const noexcept { return size_ == data_.size(); }
+
+  void clear() noexcept {
+    head_ = 0;
+    size_ = 0;
+  }
+
+ private:
+  std::vector<T> data_;
+  // where the oldest value is
+  size_t head_ = 0;
+  size_t size_ = 0;
+};
+
+}  // namespace quicky
+
+/*
+ * Implementation of template methods.
+ */
+
+namespace quicky {
+
+template <class T>
+bool RingBuffer<T>::push(const T& value) noexcept {
+  bool dropped;
+  push_slot(dropped) = value;
+  return dropped;
+}
+
+template <class T>
+bool RingBuffer<T>::push(T&& value) noexcept {
+  bool dropped;
+  push_slot(dropped) = std::move(value);
+  return dropped;
+}
+
+template <class T>
+T& RingBuffer<T>::push_slot(bool& dropped) noexcept {
+  dropped = full();
+  if (dropped) {
+    T& slot = data_[head_];
+    head_ = (head_ + 1) % data_.size();
+    return slot;
+  }
+  return data_[(head_ + size_++) % data_.size()];
+}
+
+}  // namespace quicky
@@ -0,0 +1,234 @@
+#pragma once
+
+/*
+ * Headers
+ */
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#ifdef CPPHTTPLIB_ZLIB_SUPPORT
+#include <zlib.h>
+#endif
+
+/*
+ * Declaration
+ */
+
+namespace quicky {
+
+// an append-only file bounded in size, unless max_size is 0
+// once a write would take it past max_size it is rotated: path becomes
+// path.1, path.1 becomes path.2 and so on, and the oldest of generations is
+// dropped
+// rotated files are gzipped in the background when compress is set and
+// zlib is built in, becoming path.1.gz and so on
+// rotation happens at the last line break that fits, so lines are never
+// split across files
+// several processes may append to the same file: rotating and compressing
+// are serialized among them by a flock on path.lock, and a process finding
+// path rotated by another reopens it before writing
+// not thread-safe
+class RotatingFile {
+ public:
+  RotatingFile(const std::string& path, size_t max_size, size_t generations,
+               bool compress) noexcept
+      : path_(path),
+        max_size_(max_size),
+        generations_(generations),
+        compress_(compress) {}
+
+  RotatingFile(const RotatingFile&) = delete;
+
+  RotatingFile& operator=(const RotatingFile&) = delete;
+
+  ~RotatingFile();
+
+  // append data, opening the file on first use
+  // returns false if the file can not be written
+  bool write(std::string_view data) noexcept;
+
+ private:
+  bool open() noexcept;
+
+  // whether fd_ is still the file at path, updating size_ with what every
+  // process appended to it
+  bool current() noexcept;
+
+  void rotate() noexcept;
+
+  // the lock serializing rotations among processes, -1 if it can not be
+  // taken, released by closing it
+  int lock() const noexcept;
+
+  // the name of the n-th rotated file, compressed or not
+  std::string generation(size_t n, bool gz) const {
+    return path_ + "." + std::to_string(n) + (gz ? ".gz" : "");
+  }
+
+  static bool write_all(int fd, std::string_view data) noexcept;
+
+  static bool gzip(const std::string& from, const std::string& to) noexcept;
+
+ private:
+  const std::string path_;
+  const size_t max_size_;
+  const size_t generations_;
+  const bool compress_;
+  int fd_ = -1;
+  size_t size_ = 0;
+  // compresses the last rotated file
+  std::thread compressor_;
+};
+
+}  // namespace quicky
+
+/*
+ * Implementation that will be part of the .cpp file if split into .hpp and .cpp
+ * files.
+ */
+
+namespace quicky {
+
+inline RotatingFile::~RotatingFile() {
+  if (compressor_.joinable()) compressor_.join();
+  if (fd_ >= 0) ::close(fd_);
+}
+
+inline bool RotatingFile::write(std::string_view data) noexcept {
+  if (fd_ >= 0 && !current()) {
+    ::close(fd_);
+    fd_ = -1;
+  }
+  if (fd_ < 0 && !open()) return false;
+  while (max_size_ > 0 && size_ + data.size() > max_size_) {
+    // keep whole lines together, unless a single line is too long
+    size_t fits = max_size_ > size_ ? max_size_ - size_ : 0;
+    const auto nl = data.substr(0, fits).rfind('\n');
+    fits = nl == std::string_view::npos ? (size_ == 0 ? fits : 0) : nl + 1;
+    if (!write_all(fd_, data.substr(0, fits))) return false;
+    data.remove_prefix(fits);
+    rotate();
+    if (fd_ < 0 && !open()) return false;
+    if (data.empty()) return true;
+  }
+  if (!write_all(fd_, data)) return false;
+  size_ += data.size();
+  return true;
+}
+
+inline bool RotatingFile::open() noexcept {
+  fd_ = ::open(path_.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (fd_ < 0) return false;
+  const off_t end = lseek(fd_, 0, SEEK_END);
+  size_ = end > 0 ? end : 0;
+  return true;
+}
+
+inline bool RotatingFile::current() noexcept {
+  struct stat held, named;
+  if (fstat(fd_, &held) != 0 || ::stat(path_.c_str(), &named) != 0) {
+    return false;
+  }
+  if (held.st_dev != named.st_dev || held.st_ino != named.st_ino) return false;
+  size_ = held.st_size;
+  return true;
+}
+
+inline void RotatingFile::rotate() noexcept {
+  // the previous compression reads path.1, which is about to move
+  if (compressor_.joinable()) compressor_.join();
+  const int locked = lock();
+  // another process may have rotated it while this one waited for the lock,
+  // then the file is only reopened
+  const bool rotating = current();
+  ::close(fd_);
+  fd_ = -1;
+  if (!rotating) {
+    if (locked >= 0) ::close(locked);
+    return;
+  }
+  if (generations_ == 0) {
+    unlink(path_.c_str());
+    if (locked >= 0) ::close(locked);
+    return;
+  }
+  for (bool gz : {false, true}) {
+    unlink(generation(generations_, gz).c_str());
+    for (size_t n = generations_ - 1; n >= 1; --n) {
+      std::rename(generation(n, gz).c_str(), generation(n + 1, gz).c_str());
+    }
+  }
+  const auto rotated = generation(1, false);
+  std::rename(path_.c_str(), rotated.c_str());
+#ifdef CPPHTTPLIB_ZLIB_SUPPORT
+  if (compress_) {
+    // the lock is held until path.1 is compressed, so no process moves it
+    // meanwhile
+    compressor_ = std::thread([this, rotated, locked]() {
+      if (gzip(rotated, generation(1, true))) unlink(rotated.c_str());
+      if (locked >= 0) ::close(locked);
+    });
+    return;
+  }
+#endif
+  if (locked >= 0) ::close(locked);
+}
+
+inline int RotatingFile::lock() const noexcept {
+  const auto path = path_ + ".lock";
+  const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+  if (fd < 0) return -1;
+  while (flock(fd, LOCK_EX) != 0) {
+    if (errno != EINTR) {
+      ::close(fd);
+      return -1;
+    }
+  }
+  return fd;
+}
+
+inline bool RotatingFile::write_all(int fd, std::string_view data) noexcept {
+  while (!data.empty()) {
+    const ssize_t n = ::write(fd, data.data(), data.size());
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    data.remove_prefix(n);
+  }
+  return true;
+}
+
+inline bool RotatingFile::gzip(const std::string& from,
+                               const std::string& to) noexcept {
+#ifdef CPPHTTPLIB_ZLIB_SUPPORT
+  const int in = ::open(from.c_str(), O_RDONLY | O_CLOEXEC);
+  if (in < 0) return false;
+  gzFile out = gzopen(to.c_str(), "wb");
+  bool ok = out != nullptr;
+  char buf[1 << 16];
+  ssize_t n;
+  while (ok && (n = ::read(in, buf, sizeof(buf))) > 0) {
+    ok = gzwrite(out, buf, static_cast<unsigned>(n)) == n;
+  }
+  ::close(in);
+  if (out && gzclose(out) != Z_OK) ok = false;
+  if (!ok) unlink(to.c_str());
+  return ok;
+#else
+  (void)from;
+  (void)to;
+  return false;
+#endif
+}
+
+}  // namespace quicky
@@ -0,0 +1,278 @@
+#pragma once
+
+/*
+ * Headers
+ */
+
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * Declaration
+ */
+
+extern char** environ;
+
+namespace quicky {
+
+// runs a single background process without a shell and tracks it by a pidfile
+// so that later invocations can find and stop it
+class Supervisor {
+ public:
+  Supervisor(const std::string& exe, const std::string& pidfile) noexcept
+      : exe_(exe), pidfile_(pidfile) {}
+
+  // spawn exe with args in a new session, stdout and stderr appended to
+  // out_filepath, and record its pid
+  bool start(const std::vector<std::string>& args,
+             const std::string& out_filepath = "") const noexcept;
+
+  // spawn exe like above, but with stdout and stderr piped to a process
+  // forked from this one, which runs sink on the read end of the pipe and
+  // exits once it returns
+  // the sink is detached like exe and outlives the caller, reading until exe
+  // and every process it started have exited
+  bool start(const std::vector<std::string>& args,
+             const std::function<void(int)>& sink) const noexcept;
+
+  // send SIGTERM, escalating to SIGKILL after timeout, and wait for exit,
+  // and for the sink to drain the pipe
+  // returns false if no supervised process was running
+  bool stop(std::chrono::milliseconds timeout) const noexcept;
+
+  // the pid of the running supervised process, or -1
+  pid_t pid() const noexcept;
+
+  bool running() const noexcept { return pid() > 0; }
+
+  // reap the processes started here that have exited, so a long running
+  // parent does not collect zombies of a clash or a sink that died, or was
+  // stopped by another process
+  void reap() const noexcept;
+
+ private:
+  // spawn exe with stdout and stderr going to out_fd, or appended to
+  // out_filepath if out_fd is -1, and record its pid and the sink's
+  bool spawn(const std::vector<std::string>& args,
+             const std::string& out_filepath, int out_fd,
+             pid_t sink) const noexcept;
+
+  // the pid of the process running the sink of the supervised process, or -1
+  pid_t sink_pid() const noexcept;
+
+  // whether pid is alive and still runs exe, guarding against pid reuse
+  static bool is_ours(pid_t pid, const std::string& exe) noexcept;
+
+  // whether pid has exited, reaping it if it is our child
+  static bool exited(pid_t pid) noexcept;
+
+  static bool wait_exit(pid_t pid, std::chrono::milliseconds timeout) noexcept;
+
+ private:
+  const std::string exe_;
+  const std::string pidfile_;
+  // the processes started here and not reaped yet, exe and sinks
+  mutable std::mutex children_mutex_;
+  mutable std::vector<pid_t> children_;
+};
+
+}  // namespace quicky
+
+/*
+ * Implementation that will be part of the .cpp file if split into .hpp and .cpp
+ * files.
+ */
+
+namespace quicky {
+
+inline bool Supervisor::start(const std::vector<std::string>& args,
+                              const std::string& out_filepath) const noexcept {
+  return spawn(args, out_filepath, -1, -1);
+}
+
+inline bool Supervisor::start(const std::vector<std::string>& args,
+                              const std::function<void(int)>& sink) const
+    noexcept {
+  int fds[2];
+  if (pipe2(fds, O_CLOEXEC) != 0) return false;
+  const pid_t sink_pid = fork();
+  if (sink_pid < 0) {
+    close(fds[0]);
+    close(fds[1]);
+    return false;
+  }
+  if (sink_pid == 0) {
+    // only the read end is kept, a listening socket or a connection of the
+    // parent held open here would outlive it
+    setsid();
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    dup2(fds[0], STDIN_FILENO);
+    const int devnull = open("/dev/null", O_WRONLY);
+    dup2(devnull, STDOUT_FILENO);
+    dup2(devnull, STDERR_FILENO);
+    close_range(STDERR_FILENO + 1, ~0U, 0);
+    sink(STDIN_FILENO);
+    // skip the destructors and atexit handlers of the parent's state
+    _exit(0);
+  }
+  close(fds[0]);
+  const bool ok = spawn(args, "", fds[1], sink_pid);
+  // the sink sees the end of the pipe once exe is gone
+  close(fds[1]);
+  if (!ok) {
+    wait_exit(sink_pid, std::chrono::seconds(1));
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(children_mutex_);
+  children_.push_back(sink_pid);
+  return true;
+}
+
+inline bool Supervisor::spawn(const std::vector<std::string>& args,
+                              const std::string& out_filepath, int out_fd,
+                              pid_t sink) const noexcept {
+  const std::string out = out_filepath.empty() ? "/dev/null" : out_filepath;
+  std::vector<char*> argv;
+  argv.push_back(const_cast<char*>(exe_.c_str()));
+  for (auto&& a : args) argv.push_back(const_cast<char*>(a.c_str()));
+  argv.push_back(nullptr);
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null",
+                                   O_RDONLY, 0);
+  if (out_fd >= 0) {
+    posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+  } else {
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, out.c_str(),
+                                     O_WRONLY | O_CREAT | O_APPEND, 0644);
+  }
+  posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO, STDERR_FILENO);
+
+  // a new session detaches the process from the terminal, like nohup
+  posix_spawnattr_t attr;
+  posix_spawnattr_init(&attr);
+  posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSID);
+
+  pid_t pid;
+  const int err =
+      posix_spawn(&pid, exe_.c_str(), &actions, &attr, argv.data(), environ);
+  posix_spawn_file_actions_destroy(&actions);
+  posix_spawnattr_destroy(&attr);
+  if (err != 0) return false;
+  {
+    std::lock_guard<std::mutex> lock(children_mutex_);
+    children_.push_back(pid);
+  }
+
+  std::ofstream f(pidfile_, std::ios::trunc);
+  f << pid << '\n';
+  if (sink > 0) f << sink << '\n';
+  return static_cast<bool>(f);
+}
+
+inline bool Supervisor::stop(std::chrono::milliseconds timeout) const noexcept {
+  const pid_t p = pid();
+  const pid_t sink = sink_pid();
+  unlink(pidfile_.c_str());
+  if (p > 0) {
+    ::kill(p, SIGTERM);
+    if (!wait_exit(p, timeout)) {
+      ::kill(p, SIGKILL);
+      wait_exit(p, std::chrono::seconds(1));
+    }
+  }
+  // also reaps a sink left behind by an exe that died by itself
+  if (sink > 0) wait_exit(sink, std::chrono::seconds(1));
+  // a child that already died is a zombie, which is_ours no longer knows
+  reap();
+  return p > 0;
+}
+
+inline void Supervisor::reap() const noexcept {
+  std::lock_guard<std::mutex> lock(children_mutex_);
+  children_.erase(std::remove_if(children_.begin(), children_.end(),
+                                 [](pid_t child) {
+                                   int status;
+                                   const pid_t res =
+                                       waitpid(child, &status, WNOHANG);
+                                   return res == child ||
+                                          (res < 0 && errno == ECHILD);
+                                 }),
+                  children_.end());
+}
+
+inline pid_t Supervisor::pid() const noexcept {
+  std::ifstream f(pidfile_);
+  pid_t p = -1;
+  if (!(f >> p) || !is_ours(p, exe_)) return -1;
+  return p;
+}
+
+inline pid_t Supervisor::sink_pid() const noexcept {
+  std::ifstream f(pidfile_);
+  pid_t p = -1, sink = -1;
+  // the sink runs the program that forked it, whichever started exe
+  if (!(f >> p >> sink) || !is_ours(sink, "/proc/self/exe")) return -1;
+  return sink;
+}
+
+inline bool Supervisor::is_ours(pid_t pid, const std::string& exe) noexcept {
+  if (pid <= 0 || ::kill(pid, 0) != 0) return false;
+  // the exe link is set before exec returns, unlike cmdline
+  std::error_code ec;
+  const auto path = std::filesystem::read_symlink(
+      "/proc/" + std::to_string(pid) + "/exe", ec);
+  if (ec) return false;
+  return path == std::filesystem::weakly_canonical(exe, ec);
+}
+
+inline bool Supervisor::exited(pid_t pid) noexcept {
+  int status;
+  const pid_t res = waitpid(pid, &status, WNOHANG);
+  if (res == pid) return true;
+  if (res < 0 && errno == ECHILD) {
+    // not our child, so it can only be polled, and a zombie waiting for init
+    // to reap it has exited too
+    if (::kill(pid, 0) != 0) return true;
+    std::ifstream f("/proc/" + std::to_string(pid) + "/stat");
+    std::string line;
+    std::getline(f, line);
+    const auto paren = line.rfind(')');
+    return paren != std::string::npos && paren + 2 < line.size() &&
+           line[paren + 2] == 'Z';
+  }
+  return false;
+}
+
+inline bool Supervisor::wait_exit(pid_t pid,
+                                  std::chrono::milliseconds timeout) noexcept {
+  using clock = std::chrono::steady_clock;
+  const auto deadline = clock::now() + timeout;
+  auto backoff = std::chrono::milliseconds(1);
+  while (!exited(pid)) {
+    if (clock::now() >= deadline) return false;
+    std::this_thread::sleep_for(backoff);
+    backoff = std::min(backoff * 2, std::chrono::milliseconds(50));
+  }
+  return true;
+}
+
+}  // namespace quicky
@@ -0,0 +1,217 @@
+#pragma once
+
+/*
+ * Headers
+ */
+
+#include <unistd.h>
+
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "connections.hpp"
+#include "controller.hpp"
+#include "ndjson.hpp"
+#include "net.hpp"
+#include "third-party/yhirose/httplib.h"
+#include "utils.hpp"
+
+/*
+ * Declaration
+ */
+
+namespace clashctl {
+
+// serves the controller's metrics for prometheus on GET /metrics of
+// config.metrics_endpoint, and keeps the ones sampled from clash current
+// 1. every config.daemon_refresh, the clash process and its connections
+// 2. every second, the traffic rates following /traffic
+// 3. every config.metrics_delay_interval, the delay of every proxy listed by
+//    proxies, the members of the proxy group in the owner's snapshot
+// a scrape only formats what the collectors last stored, it never waits on
+// them or on clash
+class Telemetry {
+ public:
+  Telemetry(const Config& config, const Controller& controller,
+            std::function<std::vector<std::string>()>&& proxies) noexcept
+      : config_(config),
+        controller_(controller),
+        proxies_(std::move(proxies)) {}
+
+  Telemetry(const Telemetry&) = delete;
+
+  Telemetry& operator=(const Telemetry&) = delete;
+
+  ~Telemetry() { stop(); }
+
+  // start serving and collecting in the background
+  // returns false if the endpoint can not be bound
+  bool start() noexcept;
+
+  // stop serving and collecting, and wait for the threads
+  void stop() noexcept;
+
+ private:
+  void collect_loop() noexcept;
+
+  void traffic_loop() noexcept;
+
+  // the cpu time and resident memory of the clash process
+  void sample_process() noexcept;
+
+  void sample_connections() noexcept;
+
+  void test_delays() noexcept;
+
+ private:
+  const Config& config_;
+  const Controller& controller_;
+  std::function<std::vector<std::string>()> proxies_;
+  // only touched by the collector, kept so a sample only builds the
+  // metadata of connections opened since the previous one
+  ConnectionTable connections_;
+  httplib::Server server_;
+  std::thread server_thread_;
+  std::thread collector_;
+  std::thread traffic_;
+  quicky::Sleeper sleeper_;
+};
+
+}  // namespace clashctl
+
+/*
+ * Implementation that will be part of the .cpp file if split into .hpp and .cpp
+ * files.
+ */
+
+namespace clashctl {
+
+inline bool Telemetry::start() noexcept {
+  const auto [host, port] = quicky::split_host_port(config_.metrics_endpoint);
+  // scrapes are rare and cheap, a thread or two is plenty
+  server_.new_task_queue = []() { return new httplib::ThreadPool(2); };
+  server_.Get("/metrics", [this](const httplib::Request&,
+                                 httplib::Response& res) {
+    res.set_content(controller_.metrics().render(),
+                    "text/plain; version=0.0.4");
+  });
+  if (!server_.bind_to_port(host, port)) {
+    quicky::error() << "failed to serve metrics on " << config_.metrics_endpoint
+                    << std::endl;
+    return false;
+  }
+  sleeper_.reset();
+  server_thread_ = std::thread([this]() { server_.listen_after_bind(); });
+  collector_ = std::thread(&Telemetry::collect_loop, this);
+  traffic_ = std::thread(&Telemetry::traffic_loop, this);
+  quicky::info() << "serving metrics on http://" << config_.metrics_endpoint
+                 << "/metrics" << std::endl;
+  return true;
+}
+
+inline void Telemetry::stop() noexcept {
+  sleeper_.stop();
+  server_.stop();
+  if (server_thread_.joinable()) server_thread_.join();
+  if (collector_.joinable()) collector_.join();
+  if (traffic_.joinable()) traffic_.join();
+}
+
+inline void Telemetry::collect_loop() noexcept {
+  using clock = std::chrono::steady_clock;
+  const auto delay_interval =
+      std::chrono::milliseconds(config_.metrics_delay_interval);
+  // the first round of delay tests waits for the first interval, so a
+  // restarted daemon does not test every proxy right away
+  auto next_delay_test = clock::now() + delay_interval;
+  do {
+    sample_process();
+    sample_connections();
+    if (config_.metrics_delay_interval > 0 && clock::now() >= next_delay_test) {
+      test_delays();
+      next_delay_test = clock::now() + delay_interval;
+    }
+  } while (sleeper_.sleep(std::chrono::milliseconds(config_.daemon_refresh)));
+}
+
+inline void Telemetry::traffic_loop() noexcept {
+  auto& metrics = controller_.metrics();
+  do {
+    controller_.stream(
+        "/traffic",
+        [&](std::string_view line) {
+          auto up = quicky::json_uint(line, "up");
+          auto down = quicky::json_uint(line, "down");
+          if (up.has_value() && down.has_value()) {
+            metrics.upload_rate.set(static_cast<double>(*up));
+            metrics.download_rate.set(static_cast<double>(*down));
+          }
+          return !sleeper_.stopping();
+        },
+        std::chrono::seconds(2));
+    // a rate from before clash went away would stay on the dashboards
+    metrics.upload_rate.set(0);
+    metrics.download_rate.set(0);
+  } while (sleeper_.sleep(std::chrono::milliseconds(config_.daemon_refresh)));
+}
+
+inline void Telemetry::sample_process() noexcept {
+  auto& metrics = controller_.metrics();
+  const pid_t pid = controller_.pid();
+  metrics.clash_up.set(pid > 0 ? 1 : 0);
+  if (pid <= 0) return;
+  const std::string proc = "/proc/" + std::to_string(pid);
+
+  std::ifstream stat(proc + "/stat");
+  std::string line;
+  if (std::getline(stat, line)) {
+    // the name in parentheses may hold spaces, the fields after it do not
+    const auto paren = line.rfind(')');
+    std::istringstream fields(paren == std::string::npos
+                                  ? std::string()
+                                  : line.substr(paren + 1));
+    // utime and stime are the 14th and 15th fields, the 12th and 13th after
+    // the name
+    std::string field;
+    unsigned long long utime = 0, stime = 0;
+    for (int i = 1; i <= 11 && fields >> field; ++i) {
+    }
+    if (fields >> utime >> stime) {
+      metrics.clash_cpu_seconds.set(static_cast<double>(utime + stime) /
+                                    sysconf(_SC_CLK_TCK));
+    }
+  }
+
+  std::ifstream statm(proc + "/statm");
+  unsigned long long size = 0, resident = 0;
+  if (statm >> size >> resident) {
+    metrics.clash_rss_bytes.set(static_cast<double>(resident) *
+                                sysconf(_SC_PAGESIZE));
+  }
+}
+
+inline void Telemetry::sample_connections() noexcept {
+  auto& metrics = controller_.metrics();
+  // the elapsed time only matters for the rates, which are not exported
+  if (!controller_.get_connections(connections_, std::chrono::seconds(1))) {
+    return;
+  }
+  metrics.connections.set(connections_.size());
+  metrics.upload_total.set(connections_.upload_total());
+  metrics.download_total.set(connections_.download_total());
+}
+
+inline void Telemetry::test_delays() noexcept {
+  const auto names = proxies_();
+  // get_delay records the results in the metrics
+  quicky::parallel_for(names.size(), 16, [&](size_t i) {
+    if (!sleeper_.stopping()) controller_.get_delay(names[i]);
+  });
+}
+
+}  // namespace clashctl
@@ -0,0 +1,119 @@
+#pragma once
+
+/*
+ * Headers
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+#include "ring_buffer.hpp"
+
+/*
+ * Declaration
+ */
+
+namespace clashctl {
+
+// bytes per second through clash, as sent every second by /traffic
+struct Traffic {
+  uint64_t up = 0;
+  uint64_t down = 0;
+};
+
+// rolling statistics of the traffic samples
+class TrafficMeter {
+ public:
+  // keep the samples of the last `window` seconds
+  explicit TrafficMeter(size_t window = 60) : samples_(window) {}
+
+  void push(const Traffic& sample) noexcept;
+
+  const Traffic& now() const noexcept { return samples_.back(); }
+
+  // the average of the last n samples
+  Traffic average(size_t n) const noexcept;
+
+  // the highest rates seen since the meter started
+  const Traffic& peak() const noexcept { return peak_; }
+
+  size_t count() const noexcept { return samples_.size(); }
+
+  // one line of the rates, averages and peaks, into a reused buffer
+  const std::string& format() noexcept;
+
+  // a rate like "1.5 MB/s"
+  static void format_rate(std::string& out, double bytes) noexcept;
+
+ private:
+  quicky::RingBuffer<Traffic> samples_;
+  Traffic peak_;
+  std::string line_;
+};
+
+}  // namespace clashctl
+
+/*
+ * Implementation that will be part of the .cpp file if split into .hpp and .cpp
+ * files.
+ */
+
+namespace clashctl {
+
+inline void TrafficMeter::push(const Traffic& sample) noexcept {
+  samples_.push(sample);
+  peak_.up = std::max(peak_.up, sample.up);
+  peak_.down = std::max(peak_.down, sample.down);
+}
+
+inline Traffic TrafficMeter::average(size_t n) const noexcept {
+  n = std::min(n, samples_.size());
+  Traffic sum;
+  if (n == 0) return sum;
+  for (size_t i = samples_.size() - n; i < samples_.size(); ++i) {
+    sum.up += samples_[i].up;
+    sum.down += samples_[i].down;
+  }
+  sum.up /= n;
+  sum.down /= n;
+  return sum;
+}
+
+inline const std::string& TrafficMeter::format() noexcept {
+  line_.clear();
+  if (samples_.empty()) return line_;
+  const auto avg10 = average(10);
+  const auto avg60 = average(60);
+  auto direction = [&](const char* name, uint64_t now, uint64_t a10,
+                       uint64_t a60, uint64_t peak) {
+    line_ += name;
+    format_rate(line_, now);
+    line_ += "  avg ";
+    format_rate(line_, a10);
+    line_ += " / ";
+    format_rate(line_, a60);
+    line_ += "  peak ";
+    format_rate(line_, peak);
+  };
+  direction("up ", now().up, avg10.up, avg60.up, peak_.up);
+  line_ += "  |  ";
+  direction("down ", now().down, avg10.down, avg60.down, peak_.down);
+  return line_;
+}
+
+inline void TrafficMeter::format_rate(std::string& out, double bytes) noexcept {
+  static const char* units[] = {"B/s", "KB/s", "MB/s", "GB/s"};
+  size_t unit = 0;
+  while (bytes >= 1024 && unit + 1 < sizeof(units) / sizeof(units[0])) {
+    bytes /= 1024;
+    ++unit;
+  }
+  char buf[32];
+  const int n = std::snprintf(buf, sizeof(buf), unit ? "%.1f %s" : "%.0f %s",
+                              bytes, units[unit]);
+  if (n > 0) out.append(buf, std::min<size_t>(n, sizeof(buf) - 1));
+}
+
+}  // namespace clashctl
@@ -4,9 +4,20 @@
  * Headers
  */
 
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
 #include <filesystem>
+#include <functional>
 #include <iostream>
+#include <mutex>
 #include <string>
+#include <system_error>
+#include <thread>
 #include <vector>
 
 /*
@@ -62,18 +73,54 @@ class Args {
   std::vector<std::string> args_;
 };
 
+// env
+// read an integer environment variable, falling back if unset or invalid
+int getenv_int(const char* name, int fallback) noexcept;
+
+// read an environment variable, falling back if unset or empty
+std::string getenv_str(const char* name, const std::string& fallback);
+
 // process
 int run(const std::string& cmd, const std::string& out_filepath = "") noexcept;
 
 int run_background(const std::string& cmd,
                    const std::string& out_filepath = "") noexcept;
 
-bool has_curl() noexcept;
+// call fn(i) for every i in [0, n) on at most `workers` threads, and never
+// more than 64
+// if threads can not be created, the ones running do the rest
+void parallel_for(size_t n, size_t workers,
+                  const std::function<void(size_t)>& fn) noexcept;
 
 inline int kill(const std::string& name) noexcept {
   return run("pkill -9 -f " + name);
 }
 
+// sleeps of a background loop, cut short once stop is called from another
+// thread or a signal handler calls on_signal
+class Sleeper {
+ public:
+  // sleep, returns false if stopped meanwhile
+  bool sleep(std::chrono::milliseconds duration) noexcept;
+
+  // safe to call from any thread
+  void stop() noexcept;
+
+  // let a stopped sleeper sleep again
+  void reset() noexcept { stopping_ = false; }
+
+  bool stopping() const noexcept { return stopping_ || signalled_; }
+
+  // for signal handlers, stops every sleeper of the process
+  static void on_signal(int) noexcept { signalled_ = true; }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::atomic<bool> stopping_{false};
+  static inline std::atomic<bool> signalled_{false};
+};
+
 // fs
 std::string current_path() noexcept;
 
@@ -92,13 +139,11 @@ bool rm(const std::string& filepath) noexcept;
 bool cp(const std::string& from, const std::string& to) noexcept;
 
 // web
-inline int download_file(const std::string& url,
-                         const std::string& filepath) noexcept {
-  return run("curl -o " + filepath + " \"" + url + "\"");
-}
-
 std::string trim_url(const std::string& url) noexcept;
 
+// percent-encode everything but unreserved characters, for path segments
+std::string encode_uri_component(const std::string& str) noexcept;
+
 }  // namespace quicky
 
 /*
@@ -124,6 +169,21 @@ ExeInfo::ExeInfo(string_type&& arg0) noexcept
 
 namespace quicky {
 
+// env
+inline int getenv_int(const char* name, int fallback) noexcept {
+  const char* value = std::getenv(name);
+  if (!value || !*value) return fallback;
+  char* end = nullptr;
+  const long res = std::strtol(value, &end, 10);
+  if (*end != '\0') return fallback;
+  return static_cast<int>(res);
+}
+
+inline std::string getenv_str(const char* name, const std::string& fallback) {
+  const char* value = std::getenv(name);
+  return value && *value ? value : fallback;
+}
+
 // process
 inline int run(const std::string& cmd,
                const std::string& out_filepath) noexcept {
@@ -140,7 +200,44 @@ inline int run_background(const std::string& cmd,
       ("nohup " + cmd + " > " + out_filepath + " 2>&1 &").c_str());
 }
 
-inline bool has_curl() noexcept { return run("curl --version") == 0; }
+inline void parallel_for(size_t n, size_t workers,
+                         const std::function<void(size_t)>& fn) noexcept {
+  constexpr size_t max_workers = 64;
+  workers = std::max<size_t>(1, std::min({workers, n, max_workers}));
+  std::atomic<size_t> next{0};
+  auto work = [&]() {
+    for (size_t i = next++; i < n; i = next++) fn(i);
+  };
+  std::vector<std::thread> threads;
+  threads.reserve(workers - 1);
+  for (size_t i = 1; i < workers; ++i) {
+    try {
+      threads.emplace_back(work);
+    } catch (const std::system_error& e) {
+      break;
+    }
+  }
+  work();
+  for (auto&& t : threads) t.join();
+}
+
+inline bool Sleeper::sleep(std::chrono::milliseconds duration) noexcept {
+  // in slices, a signal handler can only set the flag
+  using clock = std::chrono::steady_clock;
+  const auto deadline = clock::now() + duration;
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!stopping() && clock::now() < deadline) {
+    cv_.wait_for(lock, std::min<clock::duration>(std::chrono::milliseconds(250),
+                                                 deadline - clock::now()));
+  }
+  return !stopping();
+}
+
+inline void Sleeper::stop() noexcept {
+  std::lock_guard<std::mutex> lock(mutex_);
+  stopping_ = true;
+  cv_.notify_all();
+}
 
 // fs
 inline bool rm(const std::string& filepath) noexcept {
@@ -171,4 +268,19 @@ inline std::string trim_url(const std::string& url) noexcept {
   }
 }
 
+inline std::string encode_uri_component(const std::string& str) noexcept {
+  std::string res;
+  res.reserve(str.size());
+  for (unsigned char c : str) {
+    if (std::isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~') {
+      res += c;
+    } else {
+      char buf[4];
+      std::snprintf(buf, sizeof(buf), "%%%02X", c);
+      res += buf;
+    }
+  }
+  return res;
+}
+
 }  // namespace quicky
@@ -0,0 +1,278 @@
+#pragma once
+
+/*
+ * Headers
+ */
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <optional>
+#include <random>
+#include <string>
+
+#include "controller.hpp"
+#include "net.hpp"
+#include "third-party/nlohmann/json.hpp"
+#include "utils.hpp"
+
+/*
+ * Declaration
+ */
+
+namespace clashctl {
+
+// restarts clash when it dies, or stops answering on the proxy port or the
+// controller
+// only a clash started by clashctl is watched, one stopped by clashctl or
+// never started is left alone, even in the middle of an outage
+// restarts go through Controller::revive, retried with exponential backoff
+// and jitter until clash is back, and every outage is recorded with how long
+// it took to recover
+class Watchdog {
+ public:
+  struct Outage {
+    // when it was noticed
+    std::time_t time = 0;
+    // "exited", "unreachable" or "unresponsive"
+    std::string cause;
+    int attempts = 0;
+    // from noticing it to clash being back, at most one interval late
+    double downtime_ms = 0;
+    bool recovered = false;
+  };
+
+  // on_recovered is called after every outage clash recovered from
+  Watchdog(const Config& config, const Controller& controller,
+           std::function<void()>&& on_recovered = nullptr) noexcept
+      : config_(config),
+        controller_(controller),
+        on_recovered_(std::move(on_recovered)),
+        rng_(std::random_device()()) {}
+
+  // check clash every config.watchdog_interval until stop is called or the
+  // process is signalled
+  // returns false if another watchdog already runs
+  bool run() noexcept;
+
+  // safe to call from any thread
+  void stop() noexcept { sleeper_.stop(); }
+
+  // the delay before the n-th restart of an outage, doubling from 1s up to
+  // 5 minutes, and randomly shortened by up to half so watchdogs of many
+  // machines do not retry in lockstep
+  std::chrono::milliseconds backoff(int attempt) noexcept;
+
+  // a summary of the outages recorded in filepath, like
+  // "3 outages, 3 recovered, mttr 2.4s, longest 5.1s"
+  static std::string summary(const std::string& filepath) noexcept;
+
+ private:
+  // what is wrong with clash, nullopt if it is healthy
+  std::optional<std::string> check() const noexcept;
+
+  // add an outage to config.watchdog_stats, keeping the latest 100
+  void record(const Outage& outage) const noexcept;
+
+ private:
+  const Config& config_;
+  const Controller& controller_;
+  std::function<void()> on_recovered_;
+  std::mt19937 rng_;
+  quicky::Sleeper sleeper_;
+};
+
+}  // namespace clashctl
+
+/*
+ * Implementation that will be part of the .cpp file if split into .hpp and .cpp
+ * files.
+ */
+
+namespace clashctl {
+
+inline bool Watchdog::run() noexcept {
+  // held until the process exits, so two watchdogs never restart clash at
+  // the same time
+  const int lock = open(config_.watchdog_lock.c_str(),
+                        O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (lock < 0 || flock(lock, LOCK_EX | LOCK_NB) != 0) {
+    if (lock >= 0) close(lock);
+    quicky::errorln("another watchdog is already running.");
+    return false;
+  }
+
+  using clock = std::chrono::steady_clock;
+  const auto interval = std::chrono::milliseconds(config_.watchdog_interval);
+  std::optional<Outage> outage;
+  clock::time_point noticed;
+  // a busy clash may miss a check now and then
+  int misses = 0;
+  // record an outage clash did not recover from
+  auto give_up = [&]() {
+    const std::chrono::duration<double, std::milli> downtime =
+        clock::now() - noticed;
+    outage->downtime_ms = downtime.count();
+    record(*outage);
+    outage.reset();
+  };
+  while (!sleeper_.stopping()) {
+    // clashctl stop leaves a marker, and ends an outage being retried
+    if (quicky::exists(config_.clash_stopped)) {
+      if (outage) {
+        quicky::infoln("watchdog: clash was stopped, no longer restarting it.");
+        controller_.events().info("watchdog.given_up",
+                                  {{"cause", outage->cause},
+                                   {"attempts", outage->attempts}});
+        give_up();
+      }
+      misses = 0;
+      sleeper_.sleep(interval);
+      continue;
+    }
+    // a failed restart removes the pidfile, which is why an outage keeps
+    // being retried without it
+    if (!outage && !quicky::exists(config_.clash_pid)) {
+      sleeper_.sleep(interval);
+      continue;
+    }
+    if (outage) {
+      if (!sleeper_.sleep(backoff(outage->attempts))) break;
+    } else {
+      auto problem = check();
+      if (!problem) {
+        misses = 0;
+        sleeper_.sleep(interval);
+        continue;
+      }
+      if (*problem != "exited" && ++misses < 3) {
+        sleeper_.sleep(interval);
+        continue;
+      }
+      // stopped between the checks above and check, it only looks dead
+      if (quicky::exists(config_.clash_stopped)) continue;
+      outage = Outage{std::time(nullptr), *problem};
+      noticed = clock::now();
+      quicky::error() << "watchdog: clash " << *problem << ", restarting it."
+                      << std::endl;
+      controller_.events().error("watchdog.outage", {{"cause", *problem}});
+      controller_.metrics().watchdog_outages.inc();
+    }
+
+    ++outage->attempts;
+    controller_.metrics().watchdog_restarts.inc();
+    if (!controller_.revive()) continue;
+    const std::chrono::duration<double, std::milli> downtime =
+        clock::now() - noticed;
+    outage->downtime_ms = downtime.count();
+    outage->recovered = true;
+    quicky::info() << "watchdog: clash is back after " << outage->attempts
+                   << " restart(s), " << static_cast<long>(downtime.count())
+                   << "ms." << std::endl;
+    controller_.events().info("watchdog.recovered",
+                              {{"cause", outage->cause},
+                               {"attempts", outage->attempts},
+                               {"downtime_ms", outage->downtime_ms}});
+    record(*outage);
+    outage.reset();
+    misses = 0;
+    if (on_recovered_) on_recovered_();
+    sleeper_.sleep(interval);
+  }
+
+  if (outage) give_up();
+  close(lock);
+  return true;
+}
+
+inline std::chrono::milliseconds Watchdog::backoff(int attempt) noexcept {
+  constexpr long initial = 1000;
+  constexpr long max = 5 * 60 * 1000;
+  const long delay = std::min(max, initial << std::min(attempt - 1, 20));
+  return std::chrono::milliseconds(delay / 2 + rng_() % (delay / 2 + 1));
+}
+
+inline std::string Watchdog::summary(const std::string& filepath) noexcept {
+  try {
+    std::ifstream f(filepath);
+    if (!f) return "no outages recorded.";
+    const auto outages = nlohmann::json::parse(f).at("outages");
+    size_t recovered = 0;
+    double total = 0, longest = 0;
+    for (auto&& o : outages) {
+      if (!o.at("recovered").get<bool>()) continue;
+      ++recovered;
+      const double downtime = o.at("downtime_ms").get<double>();
+      total += downtime;
+      longest = std::max(longest, downtime);
+    }
+    char buf[128];
+    std::snprintf(buf, sizeof(buf), "%zu outages, %zu recovered",
+                  outages.size(), recovered);
+    std::string line = buf;
+    if (recovered > 0) {
+      std::snprintf(buf, sizeof(buf), ", mttr %.1fs, longest %.1fs",
+                    total / recovered / 1000, longest / 1000);
+      line += buf;
+    }
+    if (!outages.empty()) {
+      const std::time_t last = outages.back().at("time").get<std::time_t>();
+      std::strftime(buf, sizeof(buf), ", last at %Y-%m-%d %H:%M:%S",
+                    std::localtime(&last));
+      line += buf;
+    }
+    return line + ".";
+  } catch (const std::exception& e) {
+    return "invalid watchdog stats.";
+  }
+}
+
+inline std::optional<std::string> Watchdog::check() const noexcept {
+  if (!controller_.running()) return "exited";
+  const auto [host, port] = quicky::split_host_port(config_.proxy_endpoint);
+  if (!quicky::Socket::connect(host, port, std::chrono::seconds(1)).valid()) {
+    return "unreachable";
+  }
+  if (!controller_.responsive(std::chrono::seconds(2))) return "unresponsive";
+  return std::nullopt;
+}
+
+inline void Watchdog::record(const Outage& outage) const noexcept {
+  try {
+    nlohmann::json stats;
+    {
+      std::ifstream f(config_.watchdog_stats);
+      if (f) stats = nlohmann::json::parse(f, nullptr, false);
+    }
+    if (!stats.is_object() || !stats["outages"].is_array()) {
+      stats = {{"outages", nlohmann::json::array()}};
+    }
+    auto& outages = stats["outages"];
+    outages.push_back({{"time", outage.time},
+                       {"cause", outage.cause},
+                       {"attempts", outage.attempts},
+                       {"downtime_ms", outage.downtime_ms},
+                       {"recovered", outage.recovered}});
+    if (outages.size() > 100) {
+      outages.erase(outages.begin(), outages.end() - 100);
+    }
+    const auto tmp = config_.watchdog_stats + ".tmp";
+    {
+      std::ofstream f(tmp, std::ios::trunc);
+      f << stats.dump(2) << '\n';
+      if (!f) return;
+    }
+    std::rename(tmp.c_str(), config_.watchdog_stats.c_str());
+  } catch (const std::exception& e) {
+    quicky::errorln(e.what());
+  }
+}
+
+}  // namespace clashctl
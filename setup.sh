@@ -5,7 +5,9 @@
 # 2. backup clash config if exists because of previous installation and using
 # 3. cp `clashctl` the folder to $HOME and `clashctl` the executable to $HOME/clashctl
 
-requirements=("cmake" "curl" "make" "g++")
+requirements=("cmake" "make" "g++")
+# for https subscriptions and gzip encoded downloads
+libraries=("libssl-dev" "zlib1g-dev")
 
 config_file_path="$HOME/clashctl/config/config.yaml"
 
@@ -41,6 +43,17 @@ function check_installed() {
   fi
 }
 
+function check_library_installed() {
+  local package_name=$1
+  if dpkg -s "$package_name" >/dev/null 2>&1; then
+    info "$package_name has been installed."
+    return 1
+  else
+    info "$package_name has not been installed."
+    return 0
+  fi
+}
+
 function check_requirements_needed() {
   requirements_needed=()
   for r in "${requirements[@]}"; do
@@ -49,6 +62,12 @@ function check_requirements_needed() {
       requirements_needed+=("$r")
     fi
   done
+  for l in "${libraries[@]}"; do
+    check_library_installed $l
+    if [[ $? -eq 0 ]]; then
+      requirements_needed+=("$l")
+    fi
+  done
 }
 
 function ensure_requirements_installed() {
@@ -94,7 +113,8 @@ function maybe_backup_clash_config() {
 
 function recover_clash_config() {
   info "recovering config file."
-  cp config_backup/config.yaml $config_file_path
+  # config.yaml may be a symlink into the stored config generations
+  cp --remove-destination config_backup/config.yaml $config_file_path
 }
 
 function setup() {
@@ -0,0 +1,567 @@
+// a stand-in for clash, to run and load-test clashctl offline
+//
+// it serves the controller endpoints used by clashctl from made-up state,
+// and an http proxy that answers every request itself instead of going out
+// latency and failures can be injected into both
+//
+// usage: mock_clash [options]
+//   --controller <host:port>  controller address, default $CLASHCTL_CONTROLLER
+//                             or 127.0.0.1:9090
+//   --proxy-port <port>       http proxy port, default the port of
+//                             $CLASHCTL_PROXY or 7890
+//   --proxies <n>             number of proxies, default 300
+//   --conns <n>               number of open connections, default 100
+//   --log-rate <n>            log entries per second, default 10
+//   --latency <ms>            delay added to every request, default 0
+//   --jitter <ms>             random extra delay up to this, default 0
+//   --fail-rate <0..1>        share of requests failing with 503, default 0
+//   --seed <n>                seed of the made-up state
+//
+// it also takes the arguments clashctl passes to clash, so it can be copied
+// over ~/clashctl/clashctl-buildin-server
+//   -d <dir>                  ignored
+//   -f <file>                 ignored unless testing
+//   -t                        test the config file and exit
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "net.hpp"
+#include "third-party/nlohmann/json.hpp"
+#include "third-party/yhirose/httplib.h"
+
+namespace {
+
+struct Options {
+  std::string controller = "127.0.0.1:9090";
+  int proxy_port = 7890;
+  size_t proxies = 300;
+  size_t conns = 100;
+  int log_rate = 10;
+  int latency = 0;
+  int jitter = 0;
+  double fail_rate = 0;
+  unsigned seed = 1;
+  std::string config_file;
+  bool test = false;
+};
+
+struct Conn {
+  std::string host;
+  std::string port;
+  std::string proxy;
+  uint64_t upload = 0;
+  uint64_t download = 0;
+  // bytes per tick
+  uint64_t up_rate = 0;
+  uint64_t down_rate = 0;
+};
+
+// the made-up state of clash, guarded by mutex
+struct State {
+  std::mutex mutex;
+  std::mt19937 rng;
+  std::vector<std::string> names;
+  // the mean delay of each proxy, negative for one that always times out
+  std::map<std::string, int> delays;
+  std::map<std::string, std::vector<int>> history;
+  std::string proxy_now;
+  std::string final_now = "Proxies";
+  std::string mode = "rule";
+  std::map<std::string, Conn> conns;
+  uint64_t next_conn = 0;
+  // bytes moved during the last second
+  uint64_t up = 0;
+  uint64_t down = 0;
+};
+
+const char* flags[] = {"🇺🇸", "🇯🇵", "🇸🇬",
+                       "🇭🇰", "🇩🇪", "🇬🇧"};
+
+std::atomic<bool> stopping{false};
+
+// sleep like a slow clash and decide whether to fail like a broken one
+bool disturb(const Options& opts, std::mt19937& rng, std::mutex& mutex) {
+  int delay = opts.latency;
+  bool fail = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (opts.jitter > 0) delay += rng() % (opts.jitter + 1);
+    fail = opts.fail_rate > 0 &&
+           std::uniform_real_distribution<double>(0, 1)(rng) < opts.fail_rate;
+  }
+  if (delay > 0) std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+  return fail;
+}
+
+void open_conn(State& state) {
+  Conn c;
+  c.host = "h" + std::to_string(state.rng() % 5000) + ".example.com";
+  c.port = state.rng() % 2 ? "443" : "80";
+  c.proxy = state.proxy_now;
+  c.up_rate = state.rng() % 4096;
+  c.down_rate = state.rng() % 65536;
+  state.conns["conn-" + std::to_string(state.next_conn++)] = std::move(c);
+}
+
+// advance the connections by one tick of 100ms
+void tick(State& state, size_t target) {
+  std::lock_guard<std::mutex> lock(state.mutex);
+  uint64_t up = 0, down = 0;
+  for (auto it = state.conns.begin(); it != state.conns.end();) {
+    if (state.rng() % 200 == 0) {
+      it = state.conns.erase(it);
+      continue;
+    }
+    it->second.upload += it->second.up_rate;
+    it->second.download += it->second.down_rate;
+    up += it->second.up_rate;
+    down += it->second.down_rate;
+    ++it;
+  }
+  while (state.conns.size() < target) open_conn(state);
+  // a tenth of a second, scaled up to a second
+  state.up = up * 10;
+  state.down = down * 10;
+}
+
+nlohmann::json proxy_json(const State& state, const std::string& name) {
+  nlohmann::json history = nlohmann::json::array();
+  auto it = state.history.find(name);
+  if (it != state.history.end()) {
+    for (auto d : it->second) {
+      history.push_back({{"time", "2023-01-01T00:00:00.000000000Z"},
+                         {"delay", d}});
+    }
+  }
+  if (name == "DIRECT" || name == "REJECT") {
+    return {{"name", name}, {"type", name == "DIRECT" ? "Direct" : "Reject"},
+            {"udp", true}, {"history", history}};
+  }
+  if (name == "Proxies") {
+    return {{"name", name}, {"type", "Selector"}, {"now", state.proxy_now},
+            {"all", state.names}, {"history", history}};
+  }
+  if (name == "Final") {
+    return {{"name", name}, {"type", "Selector"}, {"now", state.final_now},
+            {"all", {"DIRECT", "Proxies"}}, {"history", history}};
+  }
+  if (name == "GLOBAL") {
+    return {{"name", name}, {"type", "Selector"}, {"now", "DIRECT"},
+            {"all", {"DIRECT", "REJECT", "Proxies", "Final"}},
+            {"history", history}};
+  }
+  return {{"name", name}, {"type", "Shadowsocks"}, {"udp", true},
+          {"history", history}};
+}
+
+bool is_group(const std::string& name) {
+  return name == "Proxies" || name == "Final" || name == "GLOBAL";
+}
+
+void serve_controller(const Options& opts, State& state) {
+  httplib::Server server;
+  // like clash, responses are not held back waiting for acks
+  server.set_tcp_nodelay(true);
+  std::mutex rng_mutex;
+  std::mt19937 rng(opts.seed + 1);
+
+  server.set_pre_routing_handler(
+      [&](const httplib::Request&, httplib::Response& res) {
+        if (!disturb(opts, rng, rng_mutex)) {
+          return httplib::Server::HandlerResponse::Unhandled;
+        }
+        res.status = 503;
+        res.set_content("{\"message\":\"injected failure\"}",
+                        "application/json");
+        return httplib::Server::HandlerResponse::Handled;
+      });
+
+  server.Get("/version", [&](const httplib::Request&, httplib::Response& res) {
+    res.set_content("{\"version\":\"mock\"}", "application/json");
+  });
+
+  server.Get("/proxies", [&](const httplib::Request&, httplib::Response& res) {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    nlohmann::json proxies = nlohmann::json::object();
+    for (auto&& name : state.names) proxies[name] = proxy_json(state, name);
+    for (auto name : {"DIRECT", "REJECT", "Proxies", "Final", "GLOBAL"}) {
+      proxies[name] = proxy_json(state, name);
+    }
+    res.set_content(nlohmann::json{{"proxies", proxies}}.dump(),
+                    "application/json");
+  });
+
+  server.Get(R"(/proxies/([^/]+))",
+             [&](const httplib::Request& req, httplib::Response& res) {
+               const auto name =
+                   httplib::detail::decode_url(req.matches[1], false);
+               std::lock_guard<std::mutex> lock(state.mutex);
+               if (!is_group(name) && !state.delays.count(name) &&
+                   name != "DIRECT" && name != "REJECT") {
+                 res.status = 404;
+                 return;
+               }
+               res.set_content(proxy_json(state, name).dump(),
+                               "application/json");
+             });
+
+  server.Put(R"(/proxies/([^/]+))",
+             [&](const httplib::Request& req, httplib::Response& res) {
+               const auto group =
+                   httplib::detail::decode_url(req.matches[1], false);
+               std::string name;
+               try {
+                 name = nlohmann::json::parse(req.body).at("name");
+               } catch (const std::exception& e) {
+                 res.status = 400;
+                 return;
+               }
+               std::lock_guard<std::mutex> lock(state.mutex);
+               if (group == "Proxies" && state.delays.count(name)) {
+                 state.proxy_now = name;
+               } else if (group == "Final" &&
+                          (name == "DIRECT" || name == "Proxies")) {
+                 state.final_now = name;
+               } else {
+                 res.status = 400;
+                 return;
+               }
+               res.status = 204;
+             });
+
+  server.Get(R"(/proxies/([^/]+)/delay)",
+             [&](const httplib::Request& req, httplib::Response& res) {
+               const auto name =
+                   httplib::detail::decode_url(req.matches[1], false);
+               int timeout = 5000;
+               if (req.has_param("timeout")) {
+                 timeout = std::atoi(req.get_param_value("timeout").c_str());
+               }
+               int delay;
+               {
+                 std::lock_guard<std::mutex> lock(state.mutex);
+                 auto it = state.delays.find(name);
+                 if (it == state.delays.end()) {
+                   res.status = 404;
+                   return;
+                 }
+                 delay = it->second < 0
+                             ? timeout + 1
+                             : it->second + state.rng() % (it->second / 4 + 1);
+               }
+               std::this_thread::sleep_for(
+                   std::chrono::milliseconds(std::min(delay, timeout)));
+               std::lock_guard<std::mutex> lock(state.mutex);
+               auto& history = state.history[name];
+               history.push_back(delay > timeout ? 0 : delay);
+               if (history.size() > 10) history.erase(history.begin());
+               if (delay > timeout) {
+                 res.status = 504;
+                 res.set_content("{\"message\":\"Timeout\"}",
+                                 "application/json");
+                 return;
+               }
+               res.set_content("{\"delay\":" + std::to_string(delay) + "}",
+                               "application/json");
+             });
+
+  server.Get("/configs", [&](const httplib::Request&, httplib::Response& res) {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    res.set_content(nlohmann::json{{"port", opts.proxy_port},
+                                   {"mode", state.mode},
+                                   {"log-level", "info"}}
+                        .dump(),
+                    "application/json");
+  });
+
+  server.Put("/configs", [&](const httplib::Request& req,
+                             httplib::Response& res) {
+    std::string path;
+    try {
+      path = nlohmann::json::parse(req.body).value("path", "");
+    } catch (const std::exception& e) {
+      res.status = 400;
+      return;
+    }
+    if (!path.empty() && !std::ifstream(path)) {
+      res.status = 400;
+      res.set_content("{\"message\":\"config file not found\"}",
+                      "application/json");
+      return;
+    }
+    res.status = 204;
+  });
+
+  server.Patch("/configs", [&](const httplib::Request& req,
+                               httplib::Response& res) {
+    try {
+      auto j = nlohmann::json::parse(req.body);
+      std::lock_guard<std::mutex> lock(state.mutex);
+      state.mode = j.value("mode", state.mode);
+    } catch (const std::exception& e) {
+      res.status = 400;
+      return;
+    }
+    res.status = 204;
+  });
+
+  server.Get("/traffic", [&](const httplib::Request&, httplib::Response& res) {
+    res.set_chunked_content_provider(
+        "application/json", [&](size_t, httplib::DataSink& sink) {
+          std::this_thread::sleep_for(std::chrono::seconds(1));
+          std::string line;
+          {
+            std::lock_guard<std::mutex> lock(state.mutex);
+            line = "{\"up\":" + std::to_string(state.up) +
+                   ",\"down\":" + std::to_string(state.down) + "}\n";
+          }
+          return !stopping && sink.write(line.data(), line.size());
+        });
+  });
+
+  server.Get("/logs", [&](const httplib::Request& req,
+                          httplib::Response& res) {
+    static const std::vector<std::string> levels = {"debug", "info",
+                                                    "warning", "error"};
+    auto level = std::find(levels.begin(), levels.end(),
+                           req.has_param("level")
+                               ? req.get_param_value("level")
+                               : std::string("info")) -
+                 levels.begin();
+    res.set_chunked_content_provider(
+        "application/json", [&, level](size_t, httplib::DataSink& sink) {
+          std::this_thread::sleep_for(
+              std::chrono::milliseconds(1000 / std::max(opts.log_rate, 1)));
+          size_t type;
+          std::string payload;
+          {
+            std::lock_guard<std::mutex> lock(state.mutex);
+            type = state.rng() % 10 < 7 ? 1 : state.rng() % levels.size();
+            payload = "[TCP] 127.0.0.1:" +
+                      std::to_string(30000 + state.rng() % 30000) + " --> h" +
+                      std::to_string(state.rng() % 5000) +
+                      ".example.com:443 match Match using Proxies[" +
+                      state.proxy_now + "]";
+          }
+          if (static_cast<long>(type) < level) return !stopping.load();
+          const auto line = nlohmann::json{{"type", levels[type]},
+                                           {"payload", payload}}
+                                .dump() +
+                            "\n";
+          return !stopping && sink.write(line.data(), line.size());
+        });
+  });
+
+  server.Get("/connections", [&](const httplib::Request&,
+                                 httplib::Response& res) {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    nlohmann::json conns = nlohmann::json::array();
+    uint64_t upload = 0, download = 0;
+    for (auto&& [id, c] : state.conns) {
+      upload += c.upload;
+      download += c.download;
+      conns.push_back(
+          {{"id", id},
+           {"metadata",
+            {{"network", "tcp"},
+             {"type", "HTTP Connect"},
+             {"sourceIP", "127.0.0.1"},
+             {"destinationIP", ""},
+             {"sourcePort", "50000"},
+             {"destinationPort", c.port},
+             {"host", c.host}}},
+           {"upload", c.upload},
+           {"download", c.download},
+           {"start", "2023-01-01T00:00:00.000000000Z"},
+           {"chains", {c.proxy, "Proxies"}},
+           {"rule", "Match"},
+           {"rulePayload", ""}});
+    }
+    res.set_content(nlohmann::json{{"downloadTotal", download},
+                                   {"uploadTotal", upload},
+                                   {"connections", conns}}
+                        .dump(),
+                    "application/json");
+  });
+
+  server.Delete("/connections", [&](const httplib::Request&,
+                                    httplib::Response& res) {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    state.conns.clear();
+    res.status = 204;
+  });
+
+  server.Delete(R"(/connections/([^/]+))",
+                [&](const httplib::Request& req, httplib::Response& res) {
+                  std::lock_guard<std::mutex> lock(state.mutex);
+                  res.status = state.conns.erase(req.matches[1]) ? 204 : 404;
+                });
+
+  const auto [host, port] = quicky::split_host_port(opts.controller);
+  if (!server.listen(host.c_str(), port)) {
+    std::fprintf(stderr, "failed to listen on %s\n", opts.controller.c_str());
+    std::exit(1);
+  }
+}
+
+// answers CONNECT with an established tunnel, then every request inside the
+// tunnel or sent straight to the proxy with 204
+void serve_proxy_client(const Options& opts, quicky::Socket sock,
+                        std::mt19937& rng, std::mutex& rng_mutex) {
+  constexpr auto timeout = std::chrono::seconds(30);
+  char buf[4096];
+  std::string data;
+  while (!stopping) {
+    size_t end;
+    while ((end = data.find("\r\n\r\n")) == std::string::npos) {
+      const auto n = sock.recv_some(buf, sizeof(buf), timeout);
+      if (n <= 0 || data.size() > 65536) return;
+      data.append(buf, n);
+    }
+    const auto head = data.substr(0, end);
+    data.erase(0, end + 4);
+    if (disturb(opts, rng, rng_mutex)) return;
+    if (head.compare(0, 8, "CONNECT ") == 0) {
+      if (!sock.send_all("HTTP/1.1 200 Connection established\r\n\r\n",
+                         timeout)) {
+        return;
+      }
+      continue;
+    }
+    // bodies are not expected, the response is empty either way
+    if (!sock.send_all("HTTP/1.1 204 No Content\r\nServer: mock_clash\r\n\r\n",
+                       timeout)) {
+      return;
+    }
+  }
+}
+
+void serve_proxy(const Options& opts) {
+  const int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  const int yes = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(opts.proxy_port);
+  if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+      listen(fd, 128) != 0) {
+    std::fprintf(stderr, "failed to listen on proxy port %d\n",
+                 opts.proxy_port);
+    std::exit(1);
+  }
+  std::mutex rng_mutex;
+  std::mt19937 rng(opts.seed + 2);
+  while (!stopping) {
+    const int client = accept4(fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (client < 0) continue;
+    setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+    std::thread(serve_proxy_client, std::cref(opts), quicky::Socket(client),
+                std::ref(rng), std::ref(rng_mutex))
+        .detach();
+  }
+}
+
+bool parse_args(int argc, char** argv, Options& opts) {
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (arg == "-t") {
+      opts.test = true;
+      continue;
+    }
+    if (i + 1 >= argc) return false;
+    const std::string value = argv[++i];
+    if (arg == "--controller") {
+      opts.controller = value;
+    } else if (arg == "--proxy-port") {
+      opts.proxy_port = std::atoi(value.c_str());
+    } else if (arg == "--proxies") {
+      opts.proxies = std::strtoul(value.c_str(), nullptr, 10);
+    } else if (arg == "--conns") {
+      opts.conns = std::strtoul(value.c_str(), nullptr, 10);
+    } else if (arg == "--log-rate") {
+      opts.log_rate = std::atoi(value.c_str());
+    } else if (arg == "--latency") {
+      opts.latency = std::atoi(value.c_str());
+    } else if (arg == "--jitter") {
+      opts.jitter = std::atoi(value.c_str());
+    } else if (arg == "--fail-rate") {
+      opts.fail_rate = std::atof(value.c_str());
+    } else if (arg == "--seed") {
+      opts.seed = std::strtoul(value.c_str(), nullptr, 10);
+    } else if (arg == "-f") {
+      opts.config_file = value;
+    } else if (arg != "-d") {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Options opts;
+  // started by clashctl, it listens where clashctl looks for clash
+  if (const char* controller = std::getenv("CLASHCTL_CONTROLLER")) {
+    opts.controller = controller;
+  }
+  if (const char* proxy = std::getenv("CLASHCTL_PROXY")) {
+    const int port = quicky::split_host_port(proxy).second;
+    if (port > 0) opts.proxy_port = port;
+  }
+  if (!parse_args(argc, argv, opts)) {
+    std::fprintf(stderr, "usage: %s [options], see the top of mock_clash.cpp\n",
+                 argv[0]);
+    return 2;
+  }
+  if (opts.test) {
+    // like clash -t, a config is fine as long as it can be read
+    const bool ok = opts.config_file.empty() || std::ifstream(opts.config_file);
+    std::printf("configuration file %s test %s\n", opts.config_file.c_str(),
+                ok ? "is successful" : "failed");
+    return ok ? 0 : 1;
+  }
+  signal(SIGPIPE, SIG_IGN);
+
+  State state;
+  state.rng.seed(opts.seed);
+  for (size_t i = 0; i < opts.proxies; ++i) {
+    auto name = std::string(flags[i % 6]) + " node " + std::to_string(i);
+    // one in ten never answers
+    state.delays[name] =
+        state.rng() % 10 == 0 ? -1 : 30 + static_cast<int>(state.rng() % 500);
+    state.names.push_back(std::move(name));
+  }
+  state.proxy_now = state.names.empty() ? "DIRECT" : state.names[0];
+
+  std::thread ticker([&]() {
+    while (!stopping) {
+      tick(state, opts.conns);
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+  });
+  ticker.detach();
+  std::thread(serve_proxy, std::cref(opts)).detach();
+  std::printf("mock clash: controller on %s, proxy on 127.0.0.1:%d\n",
+              opts.controller.c_str(), opts.proxy_port);
+  std::fflush(stdout);
+  serve_controller(opts, state);
+}